@@ -10,25 +10,24 @@
 #include "VL234f.hpp"
 
 #include "SunSky.hpp"
+#include "SunSkyKernels.h"
+#include "SunSkyMath.h"
 
 #include "HosekDataXYZ.h"
 #include "HosekCubic.h"
 
 #include <stdint.h>
 #include <float.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
 
 using namespace SSLib;
+using namespace SSLib::Math;
 
-// #define SIM_CLAMP                // emulate normalised integer texture, for CPU-side checking
-// #define SUPPORT_OVERCAST_CLAMP   // support overcast functionality via tables. (Without overcast, the theta table is within 0-1 anyway.)
-#define REMAP_THETA                 // remap cos theta to concentrate table around horizon
-#define HOSEK_G_FIX                 // fixes hue ringing during sunset/sunrise with BRDF version of Hosek, causing blue spots opposite
-// #define HOSEK_BRDF_ANALYTIC_H    // for A/B'ing H/FH tables vs. direct ZH evaluation
-// #define LOCAL_DEBUG              // dump debug/tuning info
+// Configuration defines (SIM_CLAMP etc.) are in SunSkyKernels.h, as they're shared with the batch kernels.
 
-#ifdef LOCAL_DEBUG
-    #include <stdio.h>
-#endif
 
 namespace
 {
@@ -292,16 +291,16 @@ float SSLib::CIEClearSkyLuminance(const Vec3f& v, const Vec3f& toSun, float Lz)
         cosThetaV = 0.0f;
 
     float cosThetaS = toSun.z;
-    float thetaS    = acosf(cosThetaS);
+    float thetaS    = Acos(cosThetaS);
 
     float cosGamma = dot(toSun, v);
-    float gamma    = acosf(cosGamma);
+    float gamma    = Acos(cosGamma);
 
-    float top1 = 0.91f + 10 * expf(-3 * gamma ) + 0.45f * sqr(cosGamma);
-    float bot1 = 0.91f + 10 * expf(-3 * thetaS) + 0.45f * sqr(cosThetaS);
+    float top1 = 0.91f + 10 * Exp(-3 * gamma ) + 0.45f * sqr(cosGamma);
+    float bot1 = 0.91f + 10 * Exp(-3 * thetaS) + 0.45f * sqr(cosThetaS);
 
-    float top2 = 1 - expf(-0.32f / (cosThetaV + 1e-6f));
-    float bot2 = 1 - expf(-0.32f);
+    float top2 = 1 - Exp(-0.32f / (cosThetaV + 1e-6f));
+    float bot2 = 1 - Exp(-0.32f);
 
     return Lz * (top1 * top2) / (bot1 * bot2);
 }
@@ -311,16 +310,16 @@ float SSLib::CIEPartlyCloudySkyLuminance(const Vec3f& v, const Vec3f& toSun, flo
     float cosThetaV = v.z;
 
     float cosThetaS = toSun.z;
-    float thetaS    = acosf(cosThetaS);
+    float thetaS    = Acos(cosThetaS);
 
     float cosGamma = dot(toSun, v);
-    float gamma    = acosf(cosGamma);
+    float gamma    = Acos(cosGamma);
 
-    float top1 = 0.526f + 5 * expf(-1.5f * gamma);
-    float bot1 = 0.526f + 5 * expf(-1.5f * thetaS);
+    float top1 = 0.526f + 5 * Exp(-1.5f * gamma);
+    float bot1 = 0.526f + 5 * Exp(-1.5f * thetaS);
 
-    float top2 = 1 - expf(-0.8f / (cosThetaV + 1e-6f));
-    float bot2 = 1 - expf(-0.8f);
+    float top2 = 1 - Exp(-0.8f / (cosThetaV + 1e-6f));
+    float bot2 = 1 - Exp(-0.8f);
 
     return Lz * (top1 * top2) / (bot1 * bot2);
 }
@@ -357,16 +356,16 @@ namespace
         float cosThetaV = v.z;
 
         float cosThetaS = toSun.z;
-        float thetaS    = acosf(cosThetaS);
+        float thetaS    = Acos(cosThetaS);
 
         float cosGamma = dot(toSun, v);
-        float gamma    = acosf(cosGamma);
+        float gamma    = Acos(cosGamma);
 
-        float top1 = 1.0f + a * expf(b / (cosThetaV + 1e-6f));
-        float bot1 = 1.0f + a * expf(b);
+        float top1 = 1.0f + a * Exp(b / (cosThetaV + 1e-6f));
+        float bot1 = 1.0f + a * Exp(b);
 
-        float top2 = 1.0f + c * expf(d * gamma ) + e * sqr(cosGamma);
-        float bot2 = 1.0f + c * expf(d * thetaS) + e * sqr(cosThetaS);
+        float top2 = 1.0f + c * Exp(d * gamma ) + e * sqr(cosGamma);
+        float bot2 = 1.0f + c * Exp(d * thetaS) + e * sqr(cosThetaS);
 
         return (top1 * top2) / (bot1 * bot2);
     }
@@ -386,6 +385,131 @@ float SSLib::ZenithLuminance(float thetaS, float T)
     return Lz;
 }
 
+const char* SSLib::BatchISA()
+{
+    return SelectedBatchKernels().mName;
+}
+
+
+//------------------------------------------------------------------------------
+// SkyDirection
+//------------------------------------------------------------------------------
+
+SkyDirection::SkyDirection(const Vec3f& v, const Vec3f& toSun) :
+    mDir(v),
+    mCosTheta(v.z < 0.0f ? 0.0f : v.z),
+    mCosGamma(dot(toSun, v)),
+    mGamma(Acos(mCosGamma)),
+    mZenith(sqrtf(mCosTheta))
+{
+}
+
+
+//------------------------------------------------------------------------------
+// SkyCIE
+//------------------------------------------------------------------------------
+
+SkyCIE::SkyCIE() :
+    mToSun(vl_z),
+    mType(kCIESkyOvercast),
+    mGradation{ 1.0f, 0.0f, 0.0f },
+    mIndicatrix{ 1.0f, 0.0f, 0.0f, 0.0f },
+    mScale(0.0f),
+    mClampHorizon(false),
+    mLinear(true)
+{
+}
+
+void SkyCIE::Update(const Vec3f& sun, float Lz, tCIESkyType type)
+{
+    mToSun = sun;
+    mType  = type;
+
+    mClampHorizon = false;
+    mLinear       = false;
+
+    switch (type)
+    {
+    case kCIESkyClear:
+        {
+            const float gradation [3] = { 1.0f, -1.0f, -0.32f };
+            const float indicatrix[4] = { 0.91f, 10.0f, -3.0f, 0.45f };
+
+            memcpy(mGradation,  gradation,  sizeof(mGradation));
+            memcpy(mIndicatrix, indicatrix, sizeof(mIndicatrix));
+            mClampHorizon = true;
+        }
+        break;
+
+    case kCIESkyOvercast:
+        mLinear = true;
+        mScale = Lz / 3.0f;
+        return;
+
+    case kCIESkyPartlyCloudy:
+        {
+            const float gradation [3] = { 1.0f, -1.0f, -0.8f };
+            const float indicatrix[4] = { 0.526f, 5.0f, -1.5f, 0.0f };
+
+            memcpy(mGradation,  gradation,  sizeof(mGradation));
+            memcpy(mIndicatrix, indicatrix, sizeof(mIndicatrix));
+        }
+        break;
+
+    default:
+        {
+            VL_ASSERT(kCIESkyStandard1 <= type && type <= kCIESkyStandard15);
+            const float* c = kCIEStandardSkyCoeffs[type - kCIESkyStandard1];
+
+            const float gradation [3] = { 1.0f, c[0], c[1] };
+            const float indicatrix[4] = { 1.0f, c[2], c[3], c[4] };
+
+            memcpy(mGradation,  gradation,  sizeof(mGradation));
+            memcpy(mIndicatrix, indicatrix, sizeof(mIndicatrix));
+        }
+    }
+
+    // Normalisation terms are the gradation at the zenith, and the indicatrix at the zenith angle of the sun
+    float cosThetaS = mToSun.z;
+    float thetaS    = Acos(cosThetaS);
+
+    float bot1 = mGradation[0] + mGradation[1] * Exp(mGradation[2]);
+    float bot2 = mIndicatrix[0] + mIndicatrix[1] * Exp(mIndicatrix[2] * thetaS) + mIndicatrix[3] * sqr(cosThetaS);
+
+    mScale = Lz / (bot1 * bot2);
+}
+
+float SkyCIE::SkyLuminance(const Vec3f& v) const
+{
+    if (mLinear)    // avoid unnecessary gamma calculation
+        return mScale * (1.0f + 2.0f * v.z);
+
+    return SkyLuminance(SkyDirection(v, mToSun));
+}
+
+float SkyCIE::SkyLuminance(const SkyDirection& d) const
+{
+    float cosThetaV = d.mDir.z;
+
+    if (mLinear)
+        return mScale * (1.0f + 2.0f * cosThetaV);
+
+    if (mClampHorizon)
+        cosThetaV = d.mCosTheta;
+
+    float top1 = mGradation[0]  + mGradation[1]  * Exp(mGradation[2] / (cosThetaV + 1e-6f));
+    float top2 = mIndicatrix[0] + mIndicatrix[1] * Exp(mIndicatrix[2] * d.mGamma) + mIndicatrix[3] * sqr(d.mCosGamma);
+
+    return mScale * top1 * top2;
+}
+
+void SkyCIE::SkyLuminance(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const
+{
+    SelectedBatchKernels().mCIELuminance(*this, dx, dy, dz, lum, n);
+}
+
+
+
 
 
 
@@ -412,14 +536,14 @@ namespace
 
     inline float PerezUpper(const float* lambdas, float cosTheta, float gamma, float cosGamma)
     {
-        return  (1.0f + lambdas[0] * expf(lambdas[1] / (cosTheta + 1e-6f)))
-              * (1.0f + lambdas[2] * expf(lambdas[3] * gamma) + lambdas[4] * sqr(cosGamma));
+        return  (1.0f + lambdas[0] * Exp(lambdas[1] / (cosTheta + 1e-6f)))
+              * (1.0f + lambdas[2] * Exp(lambdas[3] * gamma) + lambdas[4] * sqr(cosGamma));
     }
 
     inline float PerezLower(const float* lambdas, float cosThetaS, float thetaS)
     {
-        return  (1.0f + lambdas[0] * expf(lambdas[1]))
-              * (1.0f + lambdas[2] * expf(lambdas[3] * thetaS) + lambdas[4] * sqr(cosThetaS));
+        return  (1.0f + lambdas[0] * Exp(lambdas[1]))
+              * (1.0f + lambdas[2] * Exp(lambdas[3] * thetaS) + lambdas[4] * sqr(cosThetaS));
     }
 }
 
@@ -438,6 +562,11 @@ void SkyPreetham::Update(const Vec3f& sun, float turbidity, float overcast, floa
 {
     mToSun = sun;
 
+    mTurbidity  = turbidity;
+    mOvercast   = overcast;
+    mHorizCrush = horizCrush;
+    mSunset     = 1.0f;
+
     float   T = turbidity;
 
     mPerez_Y[0] =  0.17872f * T - 1.46303f;
@@ -483,6 +612,8 @@ void SkyPreetham::Update(const Vec3f& sun, float turbidity, float overcast, floa
     {
         float s = ClampUnit(1.0f + cosTheta * 50.0f);   // goes from 1 to 0 as the sun sets
 
+        mSunset = s;
+
         // Take C/E which control sun term to zero
         mPerez_x[2] *= s;
         mPerez_y[2] *= s;
@@ -540,18 +671,26 @@ void SkyPreetham::Update(const Vec3f& sun, float turbidity, float overcast, floa
 
 Vec3f SkyPreetham::SkyRGB(const Vec3f& v) const
 {
-    float cosTheta = v.z;
-    float cosGamma = dot(mToSun, v);
-    float gamma    = acosf(cosGamma);
+    return SkyRGB(SkyDirection(v, mToSun));
+}
 
-    if (cosTheta < 0.0f)
-        cosTheta = 0.0f;
+float SkyPreetham::SkyLuminance(const Vec3f& v) const
+{
+    return SkyLuminance(SkyDirection(v, mToSun));
+}
 
+Vec2f SkyPreetham::SkyChroma(const Vec3f& v) const
+{
+    return SkyChroma(SkyDirection(v, mToSun));
+}
+
+Vec3f SkyPreetham::SkyRGB(const SkyDirection& d) const
+{
     Vec3f xyY
     (
-        PerezUpper(mPerez_x, cosTheta, gamma, cosGamma),
-        PerezUpper(mPerez_y, cosTheta, gamma, cosGamma),
-        PerezUpper(mPerez_Y, cosTheta, gamma, cosGamma)
+        PerezUpper(mPerez_x, d.mCosTheta, d.mGamma, d.mCosGamma),
+        PerezUpper(mPerez_y, d.mCosTheta, d.mGamma, d.mCosGamma),
+        PerezUpper(mPerez_Y, d.mCosTheta, d.mGamma, d.mCosGamma)
     );
 
     xyY *= mPerezInvDen;
@@ -559,34 +698,32 @@ Vec3f SkyPreetham::SkyRGB(const Vec3f& v) const
     return xyYToRGB(xyY);
 }
 
-float SkyPreetham::SkyLuminance(const Vec3f& v) const
+float SkyPreetham::SkyLuminance(const SkyDirection& d) const
 {
-    float cosTheta = v.z;
-    float cosGamma = dot(mToSun, v);
-    float gamma    = acosf(cosGamma);
-
-    if (cosTheta < 0.0f)
-        cosTheta = 0.0f;
-
-    return PerezUpper(mPerez_Y, cosTheta, gamma, cosGamma) * mPerezInvDen.z;
+    return PerezUpper(mPerez_Y, d.mCosTheta, d.mGamma, d.mCosGamma) * mPerezInvDen.z;
 }
 
-Vec2f SkyPreetham::SkyChroma(const Vec3f& v) const
+Vec2f SkyPreetham::SkyChroma(const SkyDirection& d) const
 {
-    float cosTheta = v.z;
-    float cosGamma = dot(mToSun, v);
-    float gamma    = acosf(cosGamma);
-
-    if (cosTheta < 0.0f)
-        cosTheta = 0.0f;
-
     return Vec2f
     (
-        PerezUpper(mPerez_x, cosTheta, gamma, cosGamma) * mPerezInvDen.x,
-        PerezUpper(mPerez_y, cosTheta, gamma, cosGamma) * mPerezInvDen.y
+        PerezUpper(mPerez_x, d.mCosTheta, d.mGamma, d.mCosGamma) * mPerezInvDen.x,
+        PerezUpper(mPerez_y, d.mCosTheta, d.mGamma, d.mCosGamma) * mPerezInvDen.y
     );
 }
 
+void SkyPreetham::SkyRGB(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    SelectedBatchKernels().mPreethamRGB(*this, dx, dy, dz, r, g, b, n);
+}
+
+void SkyPreetham::SkyLuminance(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const
+{
+    SelectedBatchKernels().mPreethamLuminance(*this, dx, dy, dz, lum, n);
+}
+
+
+
 
 //------------------------------------------------------------------------------
 // SkyHosek
@@ -594,29 +731,6 @@ Vec2f SkyPreetham::SkyChroma(const Vec3f& v) const
 
 namespace
 {
-    inline float EvalQuintic(const float w[6], const float data[6])
-    {
-        return    w[0] * data[0]
-                + w[1] * data[1]
-                + w[2] * data[2]
-                + w[3] * data[3]
-                + w[4] * data[4]
-                + w[5] * data[5];
-    }
-
-    inline void EvalQuintic(const float w[6], const float data[6][9], float coeffs[9])
-    {
-        for (int i = 0; i < 9; i++)
-        {
-            coeffs[i] =   w[0] * data[0][i]
-                        + w[1] * data[1][i]
-                        + w[2] * data[2][i]
-                        + w[3] * data[3][i]
-                        + w[4] * data[4][i]
-                        + w[5] * data[5][i];
-        }
-    }
-
     inline void FindQuinticWeights(float s, float w[6])
     {
         float s1 = s;
@@ -640,14 +754,15 @@ namespace
     }
 
 
-    float FindHosekCoeffs
+    // Finds the quintic elevation control points for the given turbidity and albedo, by blending
+    // between the four nearest dataset entries
+    void FindHosekControlPoints
     (
         const float   dataset9[2][10][6][9],    // albedo x 2, turbidity x 10, quintics x 6, weights x 9
         const float   datasetR[2][10][6],       // albedo x 2, turbidity x 10, quintics x 6
         float         turbidity,
         float         albedo,
-        float         solarElevation,
-        float         coeffs[9]
+        float         control[6][10]
     )
     {
         int tbi = int(floorf(turbidity));
@@ -659,26 +774,6 @@ namespace
 
         float tbf = turbidity - tbi;
 
-        const float s = powf(solarElevation / vlf_halfPi, (1.0f / 3.0f));
-
-        float quinticWeights[6];
-        FindQuinticWeights(s, quinticWeights);
-
-        float ic[4][9];
-
-        EvalQuintic(quinticWeights, dataset9[0][tbi - 1], ic[0]);
-        EvalQuintic(quinticWeights, dataset9[1][tbi - 1], ic[1]);
-        EvalQuintic(quinticWeights, dataset9[0][tbi    ], ic[2]);
-        EvalQuintic(quinticWeights, dataset9[1][tbi    ], ic[3]);
-
-        float ir[4] =
-        {
-            EvalQuintic(quinticWeights, datasetR[0][tbi - 1]),
-            EvalQuintic(quinticWeights, datasetR[1][tbi - 1]),
-            EvalQuintic(quinticWeights, datasetR[0][tbi    ]),
-            EvalQuintic(quinticWeights, datasetR[1][tbi    ]),
-        };
-
         float cw[4] =
         {
             (1.0f - albedo) * (1.0f - tbf),
@@ -687,13 +782,19 @@ namespace
             albedo          * tbf,
         };
 
-        for (int i = 0; i < 9; i++)
-            coeffs[i] = cw[0] * ic[0][i]
-                      + cw[1] * ic[1][i]
-                      + cw[2] * ic[2][i]
-                      + cw[3] * ic[3][i];
-
-        return cw[0] * ir[0] + cw[1] * ir[1] + cw[2] * ir[2] + cw[3] * ir[3];
+        for (int q = 0; q < 6; q++)
+        {
+            for (int i = 0; i < 9; i++)
+                control[q][i] = cw[0] * dataset9[0][tbi - 1][q][i]
+                              + cw[1] * dataset9[1][tbi - 1][q][i]
+                              + cw[2] * dataset9[0][tbi    ][q][i]
+                              + cw[3] * dataset9[1][tbi    ][q][i];
+
+            control[q][9] = cw[0] * datasetR[0][tbi - 1][q]
+                          + cw[1] * datasetR[1][tbi - 1][q]
+                          + cw[2] * datasetR[0][tbi    ][q]
+                          + cw[3] * datasetR[1][tbi    ][q];
+        }
     }
 
     inline Vec4f CubicWeights(float s)
@@ -709,42 +810,57 @@ namespace
         return Vec4f(is3, is2 * s1 * 3.0f, is1 * s2 * 3.0f, s3);
     }
 
-    float FindHosekCoeffs
+    // Finds the cubic elevation control points for the given turbidity and albedo
+    void FindHosekControlPoints
     (
-        const float   datasetC[10][4][2][4],
+        const float   datasetC[10][4][2][4],    // radiance + coeffs x 10, elevation x 4, albedo x 2, turbidity x 4
         float         turbidity,
         float         albedo,
-        float         solarElevation,
-        float         coeffs[9]
+        float         control[6][10]
     )
     {
         const float t = (turbidity - 1.0f) / 9.0f;
-        const float s = powf(solarElevation / vlf_halfPi, (1.0f / 3.0f));
 
         Vec4f wt = CubicWeights(t);
-        Vec4f ws = CubicWeights(s);
-
-        float rad;
 
         for (int ic = 0; ic < 10; ic++)
-        {
-            Vec4f cs;
-
             for (int iz = 0; iz < 4; iz++)
             {
                 const Vec4f& ct0 = (Vec4f&) *datasetC[ic][iz][0];
                 const Vec4f& ct1 = (Vec4f&) *datasetC[ic][iz][1];
 
-                cs[iz] = dot(wt, lerp(ct0, ct1, albedo));
+                control[iz][ic == 0 ? 9 : ic - 1] = dot(wt, lerp(ct0, ct1, albedo));
             }
+    }
 
-            if (ic == 0)
-                rad = dot(ws, cs);
-            else
-                coeffs[ic - 1] = dot(ws, cs);
+    // Evaluates the elevation basis over 'control', returning the radiance and filling in coeffs
+    float FindHosekCoeffs(const float control[6][10], bool cubic, float solarElevation, float coeffs[9])
+    {
+        const float s = powf(solarElevation / vlf_halfPi, (1.0f / 3.0f));
+
+        float w[6];
+        int   n = 6;
+
+        if (cubic)
+        {
+            Vec4f ws = CubicWeights(s);
+
+            for (n = 0; n < 4; n++)
+                w[n] = ws[n];
         }
+        else
+            FindQuinticWeights(s, w);
+
+        float result[10] = { 0.0f };
 
-        return rad;
+        for (int q = 0; q < n; q++)
+            for (int i = 0; i < 10; i++)
+                result[i] += w[q] * control[q][i];
+
+        for (int i = 0; i < 9; i++)
+            coeffs[i] = result[i];
+
+        return result[9];
     }
 
     // Hosek:
@@ -768,17 +884,17 @@ namespace
     // C/E minimal effect in sunset situations, carry bulk of sun halo in sun-overhead
     // F/G sunset glow, but also takes sun halo from yellowish to white overhead
 
-    float EvalHosekCoeffs(const float coeffs[9], float cosTheta, float gamma, float cosGamma)
+    float EvalHosekCoeffs(const float coeffs[9], float cosTheta, float gamma, float cosGamma, float zenith)
     {
         // Current coeffs ordering is AB I CDEF HG
         //                            01 2 3456 78
-        const float expM   = expf(coeffs[4] * gamma);   // D g
+        // zenith = sqrt(cosTheta) is the vertical zenith gradient
+        const float expM   = Exp(coeffs[4] * gamma);    // D g
         const float rayM   = cosGamma * cosGamma;       // Rayleigh scattering
-        const float mieM   = (1.0f + rayM) / powf((1.0f + coeffs[8] * coeffs[8] - 2.0f * coeffs[8] * cosGamma), 1.5f);  // G
-        const float zenith = sqrtf(cosTheta);           // vertical zenith gradient
+        const float mieM   = (1.0f + rayM) / Pow1_5(1.0f + coeffs[8] * coeffs[8] - 2.0f * coeffs[8] * cosGamma);  // G
 
         return (1.0f
-                     + coeffs[0] * expf(coeffs[1] / (cosTheta + 0.01f))     // A, B
+                     + coeffs[0] * Exp(coeffs[1] / (cosTheta + 0.01f))     // A, B
                )
              * (1.0f
                      + coeffs[3] * expM     // C
@@ -788,6 +904,69 @@ namespace
                      + (coeffs[2] - 1.0f)   // I
                );
     }
+
+    inline float EvalHosekCoeffs(const float coeffs[9], float cosTheta, float gamma, float cosGamma)
+    {
+        return EvalHosekCoeffs(coeffs, cosTheta, gamma, cosGamma, sqrtf(cosTheta));
+    }
+
+    // Finds the control points for all three channels
+    void FindHosekControlPoints(bool cubic, float turbidity, const Vec3f& albedoXYZ, float control[3][6][10])
+    {
+        if (!cubic)
+        {
+            FindHosekControlPoints(kHosekCoeffsX, kHosekRadX, turbidity, albedoXYZ.x, control[0]);
+            FindHosekControlPoints(kHosekCoeffsY, kHosekRadY, turbidity, albedoXYZ.y, control[1]);
+            FindHosekControlPoints(kHosekCoeffsZ, kHosekRadZ, turbidity, albedoXYZ.z, control[2]);
+        }
+        else
+        {
+            FindHosekControlPoints(kHCX, turbidity, albedoXYZ.x, control[0]);
+            FindHosekControlPoints(kHCY, turbidity, albedoXYZ.y, control[1]);
+            FindHosekControlPoints(kHCZ, turbidity, albedoXYZ.z, control[2]);
+        }
+    }
+
+    // Finds the coefficients and radiance for the given sun height, including the fade out below the
+    // horizon. (Overcast is left to SkyHosek::Update, as it depends on the full sun direction.)
+    void FindHosekCoeffs(const float control[3][6][10], bool cubic, float sunZ, float turbidity, float coeffs[3][9], Vec3f& rad)
+    {
+        float solarElevation = sunZ > 0.0f ? asinf(sunZ) : 0.0f;    // altitude rather than zenith, so sin rather than cos
+
+        // Note that the hosek coefficients change with time of day, vs. Preetham where the 'upper' coefficients stay the same,
+        // and only the scaler mPerezInvDen, consisting of time-dependent normalisation and zenith luminnce factors, changes.
+
+        for (int j = 0; j < 3; j++)
+            rad[j] = FindHosekCoeffs(control[j], cubic, solarElevation, coeffs[j]);
+
+        rad *= 683; // convert to luminance in lumens
+
+        if (sunZ < 0.0f)   // sun below horizon?
+        {
+            float s = ClampUnit(1.0f + sunZ * 50.0f);   // goes from 1 to 0 as the sun sets
+            float is = 1.0f - s;
+
+            // Emulate Preetham's zenith darkening
+            float darken = ZenithLuminance(acosf(sunZ), turbidity) / ZenithLuminance(vlf_halfPi, turbidity);
+
+            // Take C/E/F which control sun term to zero
+            for (int j = 0; j < 3; j++)
+            {
+                coeffs[j][3] *= s;
+                coeffs[j][5] *= s;
+                coeffs[j][6] *= s;
+
+                // Take horizon term H to zero, as it's an orange glow at this point
+                coeffs[j][7] *= s;
+
+                // Take I term back to 1
+                coeffs[j][2] *= s;
+                coeffs[j][2] += is;
+            }
+
+            rad *= darken;
+        }
+    }
 }
 
 
@@ -800,52 +979,24 @@ void SkyHosek::Update(const Vec3f& sun, float turbidity, Vec3f rgbAlbedo, float
 {
     mToSun = sun;
 
-    float solarElevation = mToSun.z > 0.0f ? asinf(mToSun.z) : 0.0f;    // altitude rather than zenith, so sin rather than cos
-
     mAlbedo = RGBToXYZ(rgbAlbedo);
 
-    // Note that the hosek coefficients change with time of day, vs. Preetham where the 'upper' coefficients stay the same,
-    // and only the scaler mPerezInvDen, consisting of time-dependent normalisation and zenith luminnce factors, changes.
-
-    if (!mUseCubic)
-    {
-        mRadXYZ[0] = FindHosekCoeffs(kHosekCoeffsX, kHosekRadX, turbidity, mAlbedo.x, solarElevation, mCoeffsXYZ[0]);
-        mRadXYZ[1] = FindHosekCoeffs(kHosekCoeffsY, kHosekRadY, turbidity, mAlbedo.y, solarElevation, mCoeffsXYZ[1]);
-        mRadXYZ[2] = FindHosekCoeffs(kHosekCoeffsZ, kHosekRadZ, turbidity, mAlbedo.z, solarElevation, mCoeffsXYZ[2]);
-    }
+    if (mGrid && mGrid->Cubic() == mUseCubic)
+        mGrid->Find(mToSun.z, turbidity, mAlbedo, mCoeffsXYZ, mRadXYZ);
     else
     {
-        mRadXYZ[0] = FindHosekCoeffs(kHCX, turbidity, mAlbedo.x, solarElevation, mCoeffsXYZ[0]);
-        mRadXYZ[1] = FindHosekCoeffs(kHCY, turbidity, mAlbedo.y, solarElevation, mCoeffsXYZ[1]);
-        mRadXYZ[2] = FindHosekCoeffs(kHCZ, turbidity, mAlbedo.z, solarElevation, mCoeffsXYZ[2]);
-    }
-
-    mRadXYZ *= 683; // convert to luminance in lumens
-
-    if (mToSun.z < 0.0f)   // sun below horizon?
-    {
-        float s = ClampUnit(1.0f + mToSun.z * 50.0f);   // goes from 1 to 0 as the sun sets
-        float is = 1.0f - s;
-
-        // Emulate Preetham's zenith darkening
-        float darken = ZenithLuminance(acosf(mToSun.z), turbidity) / ZenithLuminance(vlf_halfPi, turbidity);
-
-        // Take C/E/F which control sun term to zero
-        for (int j = 0; j < 3; j++)
+        // Turbidity and albedo are blended into the control points only when they change, leaving
+        // just the elevation basis to evaluate as the sun moves.
+        if (turbidity != mControlTurbidity || mAlbedo != mControlAlbedo || mUseCubic != mControlCubic)
         {
-            mCoeffsXYZ[j][3] *= s;
-            mCoeffsXYZ[j][5] *= s;
-            mCoeffsXYZ[j][6] *= s;
-
-            // Take horizon term H to zero, as it's an orange glow at this point
-            mCoeffsXYZ[j][7] *= s;
+            FindHosekControlPoints(mUseCubic, turbidity, mAlbedo, mControlXYZ);
 
-            // Take I term back to 1
-            mCoeffsXYZ[j][2] *= s;
-            mCoeffsXYZ[j][2] += is;
+            mControlTurbidity = turbidity;
+            mControlAlbedo    = mAlbedo;
+            mControlCubic     = mUseCubic;
         }
 
-        mRadXYZ *= darken;
+        FindHosekCoeffs(mControlXYZ, mUseCubic, mToSun.z, turbidity, mCoeffsXYZ, mRadXYZ);
     }
 
     if (overcast != 0.0f)      // Handle overcast term
@@ -915,30 +1066,31 @@ void SkyHosek::Update(const Vec3f& sun, float turbidity, Vec3f rgbAlbedo, float
 
 float SkyHosek::SkyLuminance(const Vec3f& v) const
 {
-    float cosTheta = v.z;
-    float cosGamma = dot(mToSun, v);
-    float gamma    = acosf(cosGamma);
-
-    if (cosTheta < 0.0f)
-        cosTheta = 0.0f;
-
-    return EvalHosekCoeffs(mCoeffsXYZ[1], cosTheta, gamma, cosGamma) * mRadXYZ.y;
+    return SkyLuminance(SkyDirection(v, mToSun));
 }
 
 Vec3f SkyHosek::SkyXYZ(const Vec3f& v) const
 {
-    float cosTheta = v.z;
-    float cosGamma = dot(mToSun, v);
-    float gamma    = acosf(cosGamma);
+    return SkyXYZ(SkyDirection(v, mToSun));
+}
 
-    if (cosTheta < 0.0f)
-        cosTheta = 0.0f;
+Vec3f SkyHosek::SkyRGB(const Vec3f& v) const
+{
+    return XYZToRGB(SkyXYZ(v));
+}
 
+float SkyHosek::SkyLuminance(const SkyDirection& d) const
+{
+    return EvalHosekCoeffs(mCoeffsXYZ[1], d.mCosTheta, d.mGamma, d.mCosGamma, d.mZenith) * mRadXYZ.y;
+}
+
+Vec3f SkyHosek::SkyXYZ(const SkyDirection& d) const
+{
     Vec3f XYZ =
     {
-        EvalHosekCoeffs(mCoeffsXYZ[0], cosTheta, gamma, cosGamma),
-        EvalHosekCoeffs(mCoeffsXYZ[1], cosTheta, gamma, cosGamma),
-        EvalHosekCoeffs(mCoeffsXYZ[2], cosTheta, gamma, cosGamma)
+        EvalHosekCoeffs(mCoeffsXYZ[0], d.mCosTheta, d.mGamma, d.mCosGamma, d.mZenith),
+        EvalHosekCoeffs(mCoeffsXYZ[1], d.mCosTheta, d.mGamma, d.mCosGamma, d.mZenith),
+        EvalHosekCoeffs(mCoeffsXYZ[2], d.mCosTheta, d.mGamma, d.mCosGamma, d.mZenith)
     };
 
     XYZ *= mRadXYZ;
@@ -946,38 +1098,313 @@ Vec3f SkyHosek::SkyXYZ(const Vec3f& v) const
     return XYZ;
 }
 
-Vec3f SkyHosek::SkyRGB(const Vec3f& v) const
+Vec3f SkyHosek::SkyRGB(const SkyDirection& d) const
 {
-    return XYZToRGB(SkyXYZ(v));
+    return XYZToRGB(SkyXYZ(d));
+}
+
+void SkyHosek::SkyXYZ(const float* dx, const float* dy, const float* dz, float* X, float* Y, float* Z, size_t n) const
+{
+    SelectedBatchKernels().mHosekXYZ(*this, dx, dy, dz, X, Y, Z, n);
+}
+
+void SkyHosek::SkyRGB(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    SelectedBatchKernels().mHosekRGB(*this, dx, dy, dz, r, g, b, n);
 }
 
+void SkyHosek::SkyLuminance(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const
+{
+    SelectedBatchKernels().mHosekLuminance(*this, dx, dy, dz, lum, n);
+}
+
+
 
 //------------------------------------------------------------------------------
-// SkyTable
+// SkyHosekGrid
 //------------------------------------------------------------------------------
 
-// Pre-calculated table version, particularly useful for shader use
-
 namespace
 {
-#ifdef REMAP_THETA
-    // remap cos theta to concentrate table around horizon
-    inline float MapTheta(float t)
+    const char  kHosekGridMagic[4] = { 'S', 'S', 'H', 'G' };
+
+    // Below the horizon, sample sun z in steps of 0.02, so the fade SkyHosek does over
+    // z = [-0.02, 0] falls exactly on a grid cell.
+    const int   kHosekGridNumBelow  = 50;
+    const float kHosekGridMinSunZ   = -1.0f;
+    const float kHosekGridMinTurbidity = 1.0f;
+    const float kHosekGridMaxTurbidity = 10.0f;
+    const int   kHosekGridNumAlbedos   = 2;     // coefficients and radiance are linear in albedo
+
+    // Returns index of the lower sample, and the fraction towards the next, for
+    // t in [0, 1] across n samples
+    inline int GridCell(float t, int n, float* f)
     {
-        return t >= 0.0f ? sqrtf(t) : -sqrtf(-t);
+        t = ClampUnit(t) * float(n - 1);
+
+        int i = int(t);
+
+        if (i > n - 2)
+            i = n - 2;
+
+        *f = t - float(i);
+        return i;
     }
-    inline float UnmapTheta(float t)
+}
+
+void SkyHosekGrid::Build(bool cubic, int numElevations, int numTurbidities)
+{
+    VL_ASSERT(numElevations >= 2 && numTurbidities >= 2);
+
+    Header& h = mHeader;
+
+    memcpy(h.mMagic, kHosekGridMagic, sizeof(h.mMagic));
+    h.mVersion       = kVersion;
+    h.mCubic         = cubic;
+    h.mNumBelow      = kHosekGridNumBelow;
+    h.mNumAbove      = numElevations;
+    h.mNumTurbidities = numTurbidities;
+    h.mNumAlbedos    = kHosekGridNumAlbedos;
+    h.mMinSunZ       = kHosekGridMinSunZ;
+    h.mMinTurbidity  = kHosekGridMinTurbidity;
+    h.mMaxTurbidity  = kHosekGridMaxTurbidity;
+    h.mReserved[0]   = 0;
+    h.mReserved[1]   = 0;
+
+    mStorage.resize(NumFloats());
+    mData = mStorage.data();
+
+    const int numRows = h.mNumBelow + h.mNumAbove;
+
+    for (int it = 0; it < numTurbidities; it++)
+        for (int ia = 0; ia < kHosekGridNumAlbedos; ia++)
+        {
+            float turbidity = lerp(h.mMinTurbidity, h.mMaxTurbidity, it / float(numTurbidities - 1));
+            float albedo    = ia / float(kHosekGridNumAlbedos - 1);
+
+            float control[3][6][10];
+            FindHosekControlPoints(cubic, turbidity, Vec3f(albedo), control);
+
+            for (int ir = 0; ir < numRows; ir++)
+            {
+                float sunZ;
+
+                if (ir < int(h.mNumBelow))
+                    sunZ = h.mMinSunZ * (1.0f - ir / float(h.mNumBelow));
+                else
+                {
+                    float s = (ir - h.mNumBelow) / float(h.mNumAbove - 1);
+                    sunZ = sinf(vlf_halfPi * s * s * s);
+                }
+
+                float coeffs[3][9];
+                Vec3f rad;
+                FindHosekCoeffs(control, cubic, sunZ, turbidity, coeffs, rad);
+
+                float* entry = mStorage.data() + ((size_t(ir) * numTurbidities + it) * kHosekGridNumAlbedos + ia) * 3 * kEntrySize;
+
+                for (int j = 0; j < 3; j++, entry += kEntrySize)
+                {
+                    for (int i = 0; i < 9; i++)
+                        entry[i] = coeffs[j][i];
+
+                    entry[9] = rad[j];
+                }
+            }
+        }
+}
+
+bool SkyHosekGrid::Load(const char* path)
+{
+    mData = 0;
+    mStorage.clear();
+
+    FILE* file = fopen(path, "rb");
+
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    bool success = size > 0;
+
+    if (success)
     {
-        return t >= 0.0f ? sqr(t) : -sqr(t);
+        mStorage.resize((size + sizeof(float) - 1) / sizeof(float));
+        success = fread(mStorage.data(), 1, size, file) == size_t(size);
     }
-    inline float UnmapThetaWeight(float t)
+
+    fclose(file);
+
+    if (!success || !Use(mStorage.data(), size))
     {
-        return 2 * fabsf(t);
+        mStorage.clear();
+        return false;
     }
-#else
-    inline float MapTheta(float t)
-    {
-        return t;
+
+    return true;
+}
+
+bool SkyHosekGrid::Save(const char* path) const
+{
+    if (!Valid())
+        return false;
+
+    FILE* file = fopen(path, "wb");
+
+    if (!file)
+        return false;
+
+    bool success = fwrite(&mHeader, sizeof(Header), 1, file) == 1
+                && fwrite(mData, sizeof(float), NumFloats(), file) == NumFloats();
+
+    return fclose(file) == 0 && success;
+}
+
+bool SkyHosekGrid::Attach(const void* data, size_t size)
+{
+    mStorage.clear();
+    mStorage.shrink_to_fit();
+
+    return Use(data, size);
+}
+
+bool SkyHosekGrid::Valid() const
+{
+    return mData != 0;
+}
+
+bool SkyHosekGrid::Cubic() const
+{
+    return mHeader.mCubic != 0;
+}
+
+size_t SkyHosekGrid::Size() const
+{
+    return sizeof(Header) + NumFloats() * sizeof(float);
+}
+
+void SkyHosekGrid::Find(float sunZ, float turbidity, const Vec3f& albedoXYZ, float coeffs[3][9], Vec3f& rad) const
+{
+    VL_ASSERT(Valid());
+
+    const Header& h = mHeader;
+    const int numRows = h.mNumBelow + h.mNumAbove;
+
+    float row;
+
+    if (sunZ < 0.0f)
+        row = sunZ > h.mMinSunZ ? (1.0f - sunZ / h.mMinSunZ) * h.mNumBelow : 0.0f;
+    else
+        row = h.mNumBelow + cbrtf(asinf(sunZ < 1.0f ? sunZ : 1.0f) / vlf_halfPi) * (h.mNumAbove - 1);
+
+    float fr;
+    int   ir = GridCell(row / (numRows - 1), numRows, &fr);
+
+    float ft;
+    int   it = GridCell((turbidity - h.mMinTurbidity) / (h.mMaxTurbidity - h.mMinTurbidity), h.mNumTurbidities, &ft);
+
+    const size_t rowStride = size_t(h.mNumTurbidities) * h.mNumAlbedos * 3 * kEntrySize;
+    const size_t tStride   = size_t(h.mNumAlbedos) * 3 * kEntrySize;
+    const size_t aStride   = 3 * kEntrySize;
+
+    const float* e00 = mData + ir * rowStride + it * tStride;
+    const float* e01 = e00 + tStride;
+    const float* e10 = e00 + rowStride;
+    const float* e11 = e10 + tStride;
+
+    const float w00 = (1.0f - fr) * (1.0f - ft);
+    const float w01 = (1.0f - fr) * ft;
+    const float w10 = fr * (1.0f - ft);
+    const float w11 = fr * ft;
+
+    for (int j = 0; j < 3; j++)
+    {
+        float fa;
+        int   ia = GridCell(albedoXYZ[j], h.mNumAlbedos, &fa);
+
+        size_t o0 = ia * aStride + j * kEntrySize;
+        size_t o1 = o0 + aStride;
+
+        float entry[kEntrySize];
+
+        for (int i = 0; i < kEntrySize; i++)
+        {
+            float a0 = w00 * e00[o0 + i] + w01 * e01[o0 + i] + w10 * e10[o0 + i] + w11 * e11[o0 + i];
+            float a1 = w00 * e00[o1 + i] + w01 * e01[o1 + i] + w10 * e10[o1 + i] + w11 * e11[o1 + i];
+
+            entry[i] = a0 + fa * (a1 - a0);
+        }
+
+        for (int i = 0; i < 9; i++)
+            coeffs[j][i] = entry[i];
+
+        rad[j] = entry[9];
+    }
+}
+
+bool SkyHosekGrid::Use(const void* data, size_t size)
+{
+    mData = 0;
+
+    if (!data || size < sizeof(Header))
+        return false;
+
+    memcpy(&mHeader, data, sizeof(Header));
+
+    const Header& h = mHeader;
+
+    if (memcmp(h.mMagic, kHosekGridMagic, sizeof(h.mMagic)) != 0 || h.mVersion != kVersion)
+        return false;
+
+    if (h.mNumAbove < 2 || h.mNumTurbidities < 2 || h.mNumAlbedos < 2 || !(h.mMinTurbidity < h.mMaxTurbidity)
+     || (h.mNumBelow > 0 && !(h.mMinSunZ < 0.0f)))
+        return false;
+
+    if (size < Size())
+        return false;
+
+    mData = (const float*) ((const char*) data + sizeof(Header));
+    return true;
+}
+
+size_t SkyHosekGrid::NumFloats() const
+{
+    const Header& h = mHeader;
+    return size_t(h.mNumBelow + h.mNumAbove) * h.mNumTurbidities * h.mNumAlbedos * 3 * kEntrySize;
+}
+
+
+
+
+//------------------------------------------------------------------------------
+// SkyTable
+//------------------------------------------------------------------------------
+
+// Pre-calculated table version, particularly useful for shader use
+
+namespace
+{
+#ifdef REMAP_THETA
+    // remap cos theta to concentrate table around horizon
+    inline float MapTheta(float t)
+    {
+        return t >= 0.0f ? sqrtf(t) : -sqrtf(-t);
+    }
+    inline float UnmapTheta(float t)
+    {
+        return t >= 0.0f ? sqr(t) : -sqr(t);
+    }
+    inline float UnmapThetaWeight(float t)
+    {
+        return 2 * fabsf(t);
+    }
+#else
+    inline float MapTheta(float t)
+    {
+        return t;
     }
     inline float UnmapTheta(float t)
     {
@@ -1005,32 +1432,46 @@ namespace
     }
 }
 
-void SkyTable::FindThetaGammaTables(const SkyPreetham& pt)
+void SkyTable::UpdateSoATables()
 {
-    float dt = 1.0f / (kTableSize - 1);
-    float t = dt * 1e-6f;    // epsilon to avoid divide by 0, which can lead to NaN when m_perez_[1] = 0
-
     for (int i = 0; i < kTableSize; i++)
-    {
-        float cosTheta = UnmapTheta(t);
+        for (int j = 0; j < 3; j++)
+        {
+            mThetaTableSoA[j][i] = mThetaTable[i][j];
+            mGammaTableSoA[j][i] = mGammaTable[i][j];
+        }
+}
 
-        mThetaTable[i][0] =  -pt.mPerez_x[0] * expf(pt.mPerez_x[1] / cosTheta);
-        mThetaTable[i][1] =  -pt.mPerez_y[0] * expf(pt.mPerez_y[1] / cosTheta);
-        mThetaTable[i][2] =  -pt.mPerez_Y[0] * expf(pt.mPerez_Y[1] / cosTheta);
+void SkyTable::FindThetaGammaTables(const SkyPreetham& pt)
+{
+    // The theta table depends only on A and B, which don't depend on the sun, and the gamma table is linear in C
+    // and E, which the sun setting scales together. So we keep tables for the other settings, and scale those.
+    if (pt.mTurbidity != mBaseTurbidity || pt.mOvercast != mBaseOvercast || pt.mHorizCrush != mBaseHorizCrush)
+    {
+        SkyPreetham base;
+        base.Update(vl_z, pt.mTurbidity, pt.mOvercast, pt.mHorizCrush);   // sun overhead, so no sunset scaling
 
-        mMaxTheta = mMaxTheta >= mThetaTable[i][2] ? mMaxTheta : mThetaTable[i][2];
+        FindBaseTables(base);
+    }
 
-        float cosGamma = UnmapGamma(t);
-        float gamma = acosf(cosGamma);
+    for (int i = 0; i < kTableSize; i++)
+    {
+        mThetaTable[i] = mBaseThetaTable[i];
+        mGammaTable[i] = mBaseGammaTable[i];
+    }
 
-        mGammaTable[i][0] =  pt.mPerez_x[2] * expf(pt.mPerez_x[3] * gamma) + pt.mPerez_x[4] * sqr(cosGamma);
-        mGammaTable[i][1] =  pt.mPerez_y[2] * expf(pt.mPerez_y[3] * gamma) + pt.mPerez_y[4] * sqr(cosGamma);
-        mGammaTable[i][2] =  pt.mPerez_Y[2] * expf(pt.mPerez_Y[3] * gamma) + pt.mPerez_Y[4] * sqr(cosGamma);
+    mMaxTheta = mMaxTheta >= mBaseMaxTheta ? mMaxTheta : mBaseMaxTheta;
 
-        mMaxGamma = mMaxGamma >= mGammaTable[i][2] ? mMaxGamma : mGammaTable[i][2];
+    if (pt.mSunset != 1.0f)
+    {
+        for (int i = 0; i < kTableSize; i++)
+            mGammaTable[i] *= pt.mSunset;
 
-        t += dt;
+        float maxGamma = mBaseMaxGamma * pt.mSunset;
+        mMaxGamma = mMaxGamma >= maxGamma ? mMaxGamma : maxGamma;
     }
+    else
+        mMaxGamma = mMaxGamma >= mBaseMaxGamma ? mMaxGamma : mBaseMaxGamma;
 
     mXYZ = false;
 
@@ -1048,6 +1489,8 @@ void SkyTable::FindThetaGammaTables(const SkyPreetham& pt)
     }
 #endif
 
+    UpdateSoATables();
+
 #ifdef LOCAL_DEBUG
     printf("PTx: ");
     for (int i = 0; i < kTableSize; i += 4)
@@ -1077,6 +1520,41 @@ void SkyTable::FindThetaGammaTables(const SkyPreetham& pt)
 #endif
 }
 
+void SkyTable::FindBaseTables(const SkyPreetham& pt)
+{
+    float dt = 1.0f / (kTableSize - 1);
+    float t = dt * 1e-6f;    // epsilon to avoid divide by 0, which can lead to NaN when m_perez_[1] = 0
+
+    mBaseMaxTheta = -FLT_MAX;
+    mBaseMaxGamma = -FLT_MAX;
+
+    for (int i = 0; i < kTableSize; i++)
+    {
+        float cosTheta = UnmapTheta(t);
+
+        mBaseThetaTable[i][0] =  -pt.mPerez_x[0] * expf(pt.mPerez_x[1] / cosTheta);
+        mBaseThetaTable[i][1] =  -pt.mPerez_y[0] * expf(pt.mPerez_y[1] / cosTheta);
+        mBaseThetaTable[i][2] =  -pt.mPerez_Y[0] * expf(pt.mPerez_Y[1] / cosTheta);
+
+        mBaseMaxTheta = mBaseMaxTheta >= mBaseThetaTable[i][2] ? mBaseMaxTheta : mBaseThetaTable[i][2];
+
+        float cosGamma = UnmapGamma(t);
+        float gamma = acosf(cosGamma);
+
+        mBaseGammaTable[i][0] =  pt.mPerez_x[2] * expf(pt.mPerez_x[3] * gamma) + pt.mPerez_x[4] * sqr(cosGamma);
+        mBaseGammaTable[i][1] =  pt.mPerez_y[2] * expf(pt.mPerez_y[3] * gamma) + pt.mPerez_y[4] * sqr(cosGamma);
+        mBaseGammaTable[i][2] =  pt.mPerez_Y[2] * expf(pt.mPerez_Y[3] * gamma) + pt.mPerez_Y[4] * sqr(cosGamma);
+
+        mBaseMaxGamma = mBaseMaxGamma >= mBaseGammaTable[i][2] ? mBaseMaxGamma : mBaseGammaTable[i][2];
+
+        t += dt;
+    }
+
+    mBaseTurbidity  = pt.mTurbidity;
+    mBaseOvercast   = pt.mOvercast;
+    mBaseHorizCrush = pt.mHorizCrush;
+}
+
 void SkyTable::FindThetaGammaTables(const SkyHosek& hk)
 {
     const float (&coeffsXYZ)[3][9] = hk.mCoeffsXYZ;
@@ -1125,6 +1603,8 @@ void SkyTable::FindThetaGammaTables(const SkyHosek& hk)
     }
 #endif
 
+    UpdateSoATables();
+
 #ifdef LOCAL_DEBUG
     printf("HTY: ");
     for (int i = 0; i < kTableSize; i += 4)
@@ -1215,6 +1695,16 @@ Vec3f SkyTable::SkyRGB(const SkyHosek& hk, const Vec3f& v) const
     return XYZToRGB(XYZ);
 }
 
+void SkyTable::SkyRGB(const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    SelectedBatchKernels().mTablePreethamRGB(*this, pt, dx, dy, dz, r, g, b, n);
+}
+
+void SkyTable::SkyRGB(const SkyHosek& hk, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    SelectedBatchKernels().mTableHosekRGB(*this, hk, dx, dy, dz, r, g, b, n);
+}
+
 namespace
 {
     inline uint8_t ToU8(float f)
@@ -1500,6 +1990,18 @@ namespace
 #endif
 }
 
+void SkyBRDF::UpdateSoATables()
+{
+    for (int r = 0; r < kBRDFSamples; r++)
+        for (int i = 0; i < kTableSize; i++)
+            for (int j = 0; j < 3; j++)
+            {
+                mBRDFThetaTableSoA  [j][r * kTableSize + i] = mBRDFThetaTable  [r][i][j];
+                mBRDFGammaTableSoA  [j][r * kTableSize + i] = mBRDFGammaTable  [r][i][j];
+                mBRDFThetaTableFHSoA[j][r * kTableSize + i] = mHasHTerm ? mBRDFThetaTableFH[r][i][j] : 0.0f;
+            }
+}
+
 void SkyBRDF::FindBRDFTables(const SkyTable& table, const SkyPreetham&)
 {
     // The BRDF tables cover the entire sphere, so we must resample theta from the Perez/Hosek tables which cover a hemisphere.
@@ -1586,6 +2088,8 @@ void SkyBRDF::FindBRDFTables(const SkyTable& table, const SkyPreetham&)
             mBRDFGammaTable  [r][i] = ClampUnit(mBRDFGammaTable  [r][i]);
         }
 #endif
+
+    UpdateSoATables();
 }
 
 void SkyBRDF::FindBRDFTables(const SkyTable& table, const SkyHosek& hk)
@@ -1714,6 +2218,8 @@ void SkyBRDF::FindBRDFTables(const SkyTable& table, const SkyHosek& hk)
             mBRDFThetaTableFH[r][i] = ClampUnit(mBRDFThetaTableFH[r][i]);
         }
 #endif
+
+    UpdateSoATables();
 }
 
 Vec3f SkyBRDF::ConvolvedSkyRGB(const SkyPreetham& pt, const Vec3f& v, float r) const
@@ -1804,6 +2310,28 @@ Vec3f SkyBRDF::ConvolvedSkyRGB(const SkyHosek& hk, const Vec3f& v, float r) cons
     return XYZToRGB(XYZ);
 }
 
+void SkyBRDF::ConvolvedSkyRGB(const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n) const
+{
+    SelectedBatchKernels().mBRDFPreethamRGB(*this, pt, dx, dy, dz, roughness, r, g, b, n);
+}
+
+void SkyBRDF::ConvolvedSkyRGB(const SkyHosek& hk, const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n) const
+{
+#ifdef HOSEK_BRDF_ANALYTIC_H
+    // Cross-checking path only, so just fall back to per-sample evaluation
+    for (size_t i = 0; i < n; i++)
+    {
+        Vec3f c = ConvolvedSkyRGB(hk, Vec3f(dx[i], dy[i], dz[i]), roughness[i]);
+
+        r[i] = c.x;
+        g[i] = c.y;
+        b[i] = c.z;
+    }
+#else
+    SelectedBatchKernels().mBRDFHosekRGB(*this, hk, dx, dy, dz, roughness, r, g, b, n);
+#endif
+}
+
 void SkyBRDF::FillBRDFTexture(int width, int height, uint8_t image[][4]) const
 {
     VL_ASSERT(width == kTableSize);
@@ -1918,6 +2446,7 @@ void SkyBRDF::FillBRDFTexture(int width, int height, float image[][4]) const
 
 SunSky::SunSky() :
     mSkyType(kPreetham),
+    mStale(kPartAll),
     mToSun(vl_0),
     mTurbidity(2.5f),
     mAlbedo(vl_0),
@@ -1927,8 +2456,25 @@ SunSky::SunSky() :
 {
 }
 
+namespace
+{
+    inline bool IsCubic(tSkyType skyType)
+    {
+        return kHosekCubic <= skyType && skyType <= kHosekCubicBRDF;
+    }
+}
+
 void SunSky::SetSkyType(tSkyType skyType)
 {
+    if (skyType == mSkyType)
+        return;
+
+    // The CIE sky and the tables depend on the exact type, and Hosek on whether it's cubic
+    mStale |= kPartCIE | kPartTable | kPartBRDF;
+
+    if (IsCubic(skyType) != mHosek.mUseCubic)
+        mStale |= kPartHosek | kPartTable | kPartBRDF;
+
     mSkyType = skyType;
 }
 
@@ -1937,51 +2483,172 @@ tSkyType SunSky::SkyType() const
     return mSkyType;
 }
 
+const Vec3f& SunSky::SunDir() const
+{
+    return mToSun;
+}
+
+float SunSky::Turbidity() const
+{
+    return mTurbidity;
+}
+
+const Vec3f& SunSky::Albedo() const
+{
+    return mAlbedo;
+}
+
+float SunSky::Overcast() const
+{
+    return mOvercast;
+}
+
+float SunSky::Roughness() const
+{
+    return mRoughness;
+}
+
+const SkyHosekGrid* SunSky::HosekGrid() const
+{
+    return mHosek.mGrid;
+}
+
 void SunSky::SetSunDir(const Vec3f& v)
 {
+    if (v != mToSun)
+        mStale = kPartAll;
+
     mToSun = v;
 }
 
 void SunSky::SetTurbidity(float turbidity)
 {
+    if (turbidity != mTurbidity)
+        mStale = kPartAll;
+
     mTurbidity = turbidity;
 }
 
 void SunSky::SetAlbedo(Vec3f rgb)
 {
+    // Only Hosek has a ground albedo term
+    if (rgb != mAlbedo)
+        mStale |= kPartHosek | kPartTable | kPartBRDF;
+
     mAlbedo = rgb;
 }
 
 void SunSky::SetOvercast(float overcast)
 {
+    if (overcast != mOvercast)
+        mStale |= kPartPreetham | kPartHosek | kPartTable | kPartBRDF;
+
     mOvercast = overcast;
 }
 
 void SunSky::SetRoughness(float roughness)
 {
+    // The BRDF tables cover all roughnesses, so this is only used at evaluation time
     mRoughness = roughness;
 }
 
+void SunSky::SetHosekGrid(const SkyHosekGrid* grid)
+{
+    if (grid != mHosek.mGrid)
+        mStale |= kPartHosek | kPartTable | kPartBRDF;
+
+    mHosek.mGrid = grid;
+}
+
+namespace
+{
+    tCIESkyType CIESkyTypeFor(tSkyType skyType)
+    {
+        VL_ASSERT(kCIEClear <= skyType && skyType <= kCIEStandard15);
+
+        switch (skyType)
+        {
+        case kCIEClear:
+            return kCIESkyClear;
+        case kCIEOvercast:
+            return kCIESkyOvercast;
+        case kCIEPartlyCloudy:
+            return kCIESkyPartlyCloudy;
+        default:
+            return tCIESkyType(kCIESkyStandard1 + (skyType - kCIEStandard1));
+        }
+    }
+}
+
+// The parts of SunSky used by each sky type, and so rebuilt by Update() when stale
+const int SunSky::kSkyTypeParts[kNumSkyTypes] =
+{
+    kPartPreetham,                                  // kPreetham
+    kPartPreetham | kPartTable,                     // kPreethamTable
+    kPartPreetham | kPartTable | kPartBRDF,         // kPreethamBRDF
+    kPartHosek,                                     // kHosek
+    kPartHosek    | kPartTable,                     // kHosekTable
+    kPartHosek    | kPartTable | kPartBRDF,         // kHosekBRDF
+    kPartHosek,                                     // kHosekCubic
+    kPartHosek    | kPartTable,                     // kHosekCubicTable
+    kPartHosek    | kPartTable | kPartBRDF,         // kHosekCubicBRDF
+    kPartZenith   | kPartCIE,                       // kCIEClear
+    kPartZenith   | kPartCIE,                       // kCIEOvercast
+    kPartZenith   | kPartCIE,                       // kCIEPartlyCloudy
+    kPartZenith   | kPartCIE,                       // kCIEStandard1
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,
+    kPartZenith   | kPartCIE,                       // kCIEStandard15
+};
+
 void SunSky::Update()
 {
-    mZenithY = ZenithLuminance(acosf(mToSun.z), mTurbidity);
+    int parts = mStale & kSkyTypeParts[mSkyType];
+
+    // Parts are in dependency order
+    if (parts & kPartZenith)
+        mZenithY = ZenithLuminance(acosf(mToSun.z), mTurbidity);
+
+    if (parts & kPartCIE)
+        mCIE.Update(mToSun, mZenithY, CIESkyTypeFor(mSkyType));
+
+    if (parts & kPartPreetham)
+        mPreetham.Update(mToSun, mTurbidity, mOvercast);
 
-    mPreetham.Update(mToSun, mTurbidity, mOvercast);
+    if (parts & kPartHosek)
+    {
+        mHosek.mUseCubic = IsCubic(mSkyType);
+        mHosek.Update(mToSun, mTurbidity, mAlbedo, mOvercast);
+    }
 
-    mHosek.mUseCubic = (kHosekCubic <= mSkyType && mSkyType <= kHosekCubicBRDF);
-    mHosek.Update(mToSun, mTurbidity, mAlbedo, mOvercast);
+    if (parts & kPartTable)
+    {
+        if (mSkyType <= kPreethamBRDF)
+            mTable.FindThetaGammaTables(mPreetham);
+        else
+            mTable.FindThetaGammaTables(mHosek);
+    }
 
-    if (kPreethamTable <= mSkyType && mSkyType <= kPreethamBRDF)
-        mTable.FindThetaGammaTables(mPreetham);
-    else if (kHosekTable <= mSkyType && mSkyType <= kHosekBRDF)
-        mTable.FindThetaGammaTables(mHosek);
-    else if (kHosekCubicTable <= mSkyType && mSkyType <= kHosekCubicBRDF)
-        mTable.FindThetaGammaTables(mHosek);
+    if (parts & kPartBRDF)
+    {
+        if (mSkyType == kPreethamBRDF)
+            mBRDF.FindBRDFTables(mTable, mPreetham);
+        else
+            mBRDF.FindBRDFTables(mTable, mHosek);
+    }
 
-    if (mSkyType == kPreethamBRDF)
-        mBRDF.FindBRDFTables(mTable, mPreetham);
-    if (mSkyType == kHosekBRDF || mSkyType == kHosekCubicBRDF)
-        mBRDF.FindBRDFTables(mTable, mHosek);
+    mStale &= ~parts;
 }
 
 Vec3f SunSky::SkyRGB(const Vec3f& v) const
@@ -2007,17 +2674,55 @@ Vec3f SunSky::SkyRGB(const Vec3f& v) const
         return mBRDF.ConvolvedSkyRGB(mHosek, v, mRoughness);
 
     case kCIEClear:
-        return Vec3f(CIEClearSkyLuminance       (v, mToSun, mZenithY));
     case kCIEOvercast:
-        return Vec3f(CIEOvercastSkyLuminance    (v,         mZenithY));
     case kCIEPartlyCloudy:
-        return Vec3f(CIEPartlyCloudySkyLuminance(v, mToSun, mZenithY));
+    case kCIEStandard1:
+    case kCIEStandard2:
+    case kCIEStandard3:
+    case kCIEStandard4:
+    case kCIEStandard5:
+    case kCIEStandard6:
+    case kCIEStandard7:
+    case kCIEStandard8:
+    case kCIEStandard9:
+    case kCIEStandard10:
+    case kCIEStandard11:
+    case kCIEStandard12:
+    case kCIEStandard13:
+    case kCIEStandard14:
+    case kCIEStandard15:
+        return Vec3f(mCIE.SkyLuminance(v));
 
     default:
         return vl_0;
     }
 }
 
+void SunSky::ConvolvedSkyRGB(const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n) const
+{
+    switch (mSkyType)
+    {
+    case kPreethamBRDF:
+        mBRDF.ConvolvedSkyRGB(mPreetham, dx, dy, dz, roughness, r, g, b, n);
+        return;
+
+    case kHosekBRDF:
+    case kHosekCubicBRDF:
+        mBRDF.ConvolvedSkyRGB(mHosek, dx, dy, dz, roughness, r, g, b, n);
+        return;
+
+    default:
+        for (size_t i = 0; i < n; i++)
+        {
+            Vec3f c = SkyRGB(Vec3f(dx[i], dy[i], dz[i]));
+
+            r[i] = c.x;
+            g[i] = c.y;
+            b[i] = c.z;
+        }
+    }
+}
+
 float SunSky::SkyLuminance(const Vec3f& v) const
 {
     if (v.z < 0.0)
@@ -2028,11 +2733,24 @@ float SunSky::SkyLuminance(const Vec3f& v) const
     case kPreetham:
         return mPreetham.SkyLuminance(v);
     case kCIEClear:
-        return CIEClearSkyLuminance       (v, mToSun, mZenithY);
     case kCIEOvercast:
-        return CIEOvercastSkyLuminance    (v,         mZenithY);
     case kCIEPartlyCloudy:
-        return CIEPartlyCloudySkyLuminance(v, mToSun, mZenithY);
+    case kCIEStandard1:
+    case kCIEStandard2:
+    case kCIEStandard3:
+    case kCIEStandard4:
+    case kCIEStandard5:
+    case kCIEStandard6:
+    case kCIEStandard7:
+    case kCIEStandard8:
+    case kCIEStandard9:
+    case kCIEStandard10:
+    case kCIEStandard11:
+    case kCIEStandard12:
+    case kCIEStandard13:
+    case kCIEStandard14:
+    case kCIEStandard15:
+        return mCIE.SkyLuminance(v);
     case kHosek:
     case kHosekCubic:
         return mHosek.SkyLuminance(v);
@@ -2041,21 +2759,104 @@ float SunSky::SkyLuminance(const Vec3f& v) const
     }
 }
 
-Vec2f SunSky::SkyChroma(const Vec3f& v) const
+Vec3f SunSky::SkyRGB(const SkyDirection& d) const
 {
-    if (v.z < 0.0)
-        return Vec2f(0, 0);
-
     switch (mSkyType)
     {
     case kPreetham:
-        return mPreetham.SkyChroma(v);
+        return mPreetham.SkyRGB(d);
+
+    case kPreethamTable:
+        return mTable.SkyRGB(mPreetham, d.mDir);
+    case kPreethamBRDF:
+        return mBRDF.ConvolvedSkyRGB(mPreetham, d.mDir, mRoughness);
+
+    case kHosek:
+    case kHosekCubic:
+        return mHosek.SkyRGB(d);
+    case kHosekTable:
+    case kHosekCubicTable:
+        return mTable.SkyRGB(mHosek, d.mDir);
+    case kHosekBRDF:
+    case kHosekCubicBRDF:
+        return mBRDF.ConvolvedSkyRGB(mHosek, d.mDir, mRoughness);
+
     case kCIEClear:
-        return kClearChroma;
     case kCIEOvercast:
-        return kOvercastChroma;
     case kCIEPartlyCloudy:
-        return kPartlyCloudyChroma;
+    case kCIEStandard1:
+    case kCIEStandard2:
+    case kCIEStandard3:
+    case kCIEStandard4:
+    case kCIEStandard5:
+    case kCIEStandard6:
+    case kCIEStandard7:
+    case kCIEStandard8:
+    case kCIEStandard9:
+    case kCIEStandard10:
+    case kCIEStandard11:
+    case kCIEStandard12:
+    case kCIEStandard13:
+    case kCIEStandard14:
+    case kCIEStandard15:
+        return Vec3f(mCIE.SkyLuminance(d));
+
+    default:
+        return vl_0;
+    }
+}
+
+float SunSky::SkyLuminance(const SkyDirection& d) const
+{
+    if (d.mDir.z < 0.0)
+        return 0.0;
+
+    switch (mSkyType)
+    {
+    case kPreetham:
+        return mPreetham.SkyLuminance(d);
+    case kCIEClear:
+    case kCIEOvercast:
+    case kCIEPartlyCloudy:
+    case kCIEStandard1:
+    case kCIEStandard2:
+    case kCIEStandard3:
+    case kCIEStandard4:
+    case kCIEStandard5:
+    case kCIEStandard6:
+    case kCIEStandard7:
+    case kCIEStandard8:
+    case kCIEStandard9:
+    case kCIEStandard10:
+    case kCIEStandard11:
+    case kCIEStandard12:
+    case kCIEStandard13:
+    case kCIEStandard14:
+    case kCIEStandard15:
+        return mCIE.SkyLuminance(d);
+    case kHosek:
+    case kHosekCubic:
+        return mHosek.SkyLuminance(d);
+    default:
+        return 0;
+    }
+}
+
+Vec2f SunSky::SkyChroma(const Vec3f& v) const
+{
+    if (v.z < 0.0)
+        return Vec2f(0, 0);
+
+    switch (mSkyType)
+    {
+    case kPreetham:
+        return mPreetham.SkyChroma(v);
+    case kCIEClear:
+        return kClearChroma;
+    case kCIEOvercast:
+        return kOvercastChroma;
+    case kCIEPartlyCloudy:
+        return kPartlyCloudyChroma;
     case kHosek:
     case kHosekCubic:
         {
@@ -2067,6 +2868,408 @@ Vec2f SunSky::SkyChroma(const Vec3f& v) const
     }
 }
 
+// Batch evaluation. The public entry points switch on the sky type once per
+// call, and then run SkyRGBBatch/SkyLuminanceBatch for that type. These gather
+// the directions into SoA chunks for the model's SIMD path, via SkyRGBSoA or
+// SkyLuminanceSoA, which are specialised for one representative type per
+// model. (The cubic Hosek types share the Hosek ones, as mHosek knows which
+// it is, and similarly all CIE skies share kCIEClear.)
+
+namespace
+{
+    const size_t kBatchChunk = 256;
+}
+
+template<> void SunSky::SkyRGBSoA<kPreetham>(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    mPreetham.SkyRGB(dx, dy, dz, r, g, b, n);
+}
+
+template<> void SunSky::SkyRGBSoA<kPreethamTable>(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    mTable.SkyRGB(mPreetham, dx, dy, dz, r, g, b, n);
+}
+
+template<> void SunSky::SkyRGBSoA<kPreethamBRDF>(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    VL_ASSERT(n <= kBatchChunk);
+    float roughness[kBatchChunk];
+
+    for (size_t i = 0; i < n; i++)
+        roughness[i] = mRoughness;
+
+    mBRDF.ConvolvedSkyRGB(mPreetham, dx, dy, dz, roughness, r, g, b, n);
+}
+
+template<> void SunSky::SkyRGBSoA<kHosek>(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    mHosek.SkyRGB(dx, dy, dz, r, g, b, n);
+}
+
+template<> void SunSky::SkyRGBSoA<kHosekTable>(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    mTable.SkyRGB(mHosek, dx, dy, dz, r, g, b, n);
+}
+
+template<> void SunSky::SkyRGBSoA<kHosekBRDF>(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    VL_ASSERT(n <= kBatchChunk);
+    float roughness[kBatchChunk];
+
+    for (size_t i = 0; i < n; i++)
+        roughness[i] = mRoughness;
+
+    mBRDF.ConvolvedSkyRGB(mHosek, dx, dy, dz, roughness, r, g, b, n);
+}
+
+template<> void SunSky::SkyRGBSoA<kCIEClear>(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    mCIE.SkyLuminance(dx, dy, dz, r, n);
+
+    for (size_t i = 0; i < n; i++)
+        g[i] = b[i] = r[i];
+}
+
+template<> void SunSky::SkyLuminanceSoA<kPreetham>(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const
+{
+    mPreetham.SkyLuminance(dx, dy, dz, lum, n);
+}
+
+template<> void SunSky::SkyLuminanceSoA<kHosek>(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const
+{
+    mHosek.SkyLuminance(dx, dy, dz, lum, n);
+}
+
+template<> void SunSky::SkyLuminanceSoA<kCIEClear>(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const
+{
+    mCIE.SkyLuminance(dx, dy, dz, lum, n);
+}
+
+template<tSkyType T> void SunSky::SkyRGBBatch(const Vec3f* v, Vec3f* rgb, size_t n) const
+{
+    float dx[kBatchChunk], dy[kBatchChunk], dz[kBatchChunk];
+    float r [kBatchChunk], g [kBatchChunk], b [kBatchChunk];
+
+    for (size_t i = 0; i < n; i += kBatchChunk)
+    {
+        size_t m = n - i < kBatchChunk ? n - i : kBatchChunk;
+
+        for (size_t j = 0; j < m; j++)
+        {
+            dx[j] = v[i + j].x;
+            dy[j] = v[i + j].y;
+            dz[j] = v[i + j].z;
+        }
+
+        SkyRGBSoA<T>(dx, dy, dz, r, g, b, m);
+
+        for (size_t j = 0; j < m; j++)
+            rgb[i + j] = Vec3f(r[j], g[j], b[j]);
+    }
+}
+
+template<tSkyType T> void SunSky::SkyRGBBatchSoA(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    for (size_t i = 0; i < n; i += kBatchChunk)
+    {
+        size_t m = n - i < kBatchChunk ? n - i : kBatchChunk;
+
+        SkyRGBSoA<T>(dx + i, dy + i, dz + i, r + i, g + i, b + i, m);
+    }
+}
+
+template<tSkyType T> void SunSky::SkyLuminanceBatch(const Vec3f* v, float* lum, size_t n) const
+{
+    float dx[kBatchChunk], dy[kBatchChunk], dz[kBatchChunk];
+
+    for (size_t i = 0; i < n; i += kBatchChunk)
+    {
+        size_t m = n - i < kBatchChunk ? n - i : kBatchChunk;
+
+        for (size_t j = 0; j < m; j++)
+        {
+            dx[j] = v[i + j].x;
+            dy[j] = v[i + j].y;
+            dz[j] = v[i + j].z;
+        }
+
+        SkyLuminanceSoA<T>(dx, dy, dz, lum + i, m);
+
+        for (size_t j = 0; j < m; j++)  // as with SkyLuminance(v), below the horizon is black
+            if (dz[j] < 0.0f)
+                lum[i + j] = 0.0f;
+    }
+}
+
+void SunSky::SkyRGB(const Vec3f* v, Vec3f* rgb, size_t n) const
+{
+    switch (mSkyType)
+    {
+    case kPreetham:
+        SkyRGBBatch<kPreetham>(v, rgb, n);
+        return;
+
+    case kPreethamTable:
+        SkyRGBBatch<kPreethamTable>(v, rgb, n);
+        return;
+    case kPreethamBRDF:
+        SkyRGBBatch<kPreethamBRDF>(v, rgb, n);
+        return;
+
+    case kHosek:
+    case kHosekCubic:
+        SkyRGBBatch<kHosek>(v, rgb, n);
+        return;
+    case kHosekTable:
+    case kHosekCubicTable:
+        SkyRGBBatch<kHosekTable>(v, rgb, n);
+        return;
+    case kHosekBRDF:
+    case kHosekCubicBRDF:
+        SkyRGBBatch<kHosekBRDF>(v, rgb, n);
+        return;
+
+    case kCIEClear:
+    case kCIEOvercast:
+    case kCIEPartlyCloudy:
+    case kCIEStandard1:
+    case kCIEStandard2:
+    case kCIEStandard3:
+    case kCIEStandard4:
+    case kCIEStandard5:
+    case kCIEStandard6:
+    case kCIEStandard7:
+    case kCIEStandard8:
+    case kCIEStandard9:
+    case kCIEStandard10:
+    case kCIEStandard11:
+    case kCIEStandard12:
+    case kCIEStandard13:
+    case kCIEStandard14:
+    case kCIEStandard15:
+        SkyRGBBatch<kCIEClear>(v, rgb, n);
+        return;
+
+    default:
+        for (size_t i = 0; i < n; i++)
+            rgb[i] = vl_0;
+    }
+}
+
+void SunSky::SkyRGB(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const
+{
+    switch (mSkyType)
+    {
+    case kPreetham:
+        SkyRGBBatchSoA<kPreetham>(dx, dy, dz, r, g, b, n);
+        return;
+
+    case kPreethamTable:
+        SkyRGBBatchSoA<kPreethamTable>(dx, dy, dz, r, g, b, n);
+        return;
+    case kPreethamBRDF:
+        SkyRGBBatchSoA<kPreethamBRDF>(dx, dy, dz, r, g, b, n);
+        return;
+
+    case kHosek:
+    case kHosekCubic:
+        SkyRGBBatchSoA<kHosek>(dx, dy, dz, r, g, b, n);
+        return;
+    case kHosekTable:
+    case kHosekCubicTable:
+        SkyRGBBatchSoA<kHosekTable>(dx, dy, dz, r, g, b, n);
+        return;
+    case kHosekBRDF:
+    case kHosekCubicBRDF:
+        SkyRGBBatchSoA<kHosekBRDF>(dx, dy, dz, r, g, b, n);
+        return;
+
+    case kCIEClear:
+    case kCIEOvercast:
+    case kCIEPartlyCloudy:
+    case kCIEStandard1:
+    case kCIEStandard2:
+    case kCIEStandard3:
+    case kCIEStandard4:
+    case kCIEStandard5:
+    case kCIEStandard6:
+    case kCIEStandard7:
+    case kCIEStandard8:
+    case kCIEStandard9:
+    case kCIEStandard10:
+    case kCIEStandard11:
+    case kCIEStandard12:
+    case kCIEStandard13:
+    case kCIEStandard14:
+    case kCIEStandard15:
+        SkyRGBBatchSoA<kCIEClear>(dx, dy, dz, r, g, b, n);
+        return;
+
+    default:
+        for (size_t i = 0; i < n; i++)
+            r[i] = g[i] = b[i] = 0.0f;
+    }
+}
+
+void SunSky::SkyLuminance(const Vec3f* v, float* lum, size_t n) const
+{
+    switch (mSkyType)
+    {
+    case kPreetham:
+        SkyLuminanceBatch<kPreetham>(v, lum, n);
+        return;
+    case kCIEClear:
+    case kCIEOvercast:
+    case kCIEPartlyCloudy:
+    case kCIEStandard1:
+    case kCIEStandard2:
+    case kCIEStandard3:
+    case kCIEStandard4:
+    case kCIEStandard5:
+    case kCIEStandard6:
+    case kCIEStandard7:
+    case kCIEStandard8:
+    case kCIEStandard9:
+    case kCIEStandard10:
+    case kCIEStandard11:
+    case kCIEStandard12:
+    case kCIEStandard13:
+    case kCIEStandard14:
+    case kCIEStandard15:
+        SkyLuminanceBatch<kCIEClear>(v, lum, n);
+        return;
+    case kHosek:
+    case kHosekCubic:
+        SkyLuminanceBatch<kHosek>(v, lum, n);
+        return;
+    default:
+        for (size_t i = 0; i < n; i++)
+            lum[i] = 0.0f;
+    }
+}
+
+namespace
+{
+    tBatchModel BatchModelFor(tSkyType skyType)
+    {
+        switch (skyType)
+        {
+        case kPreetham:
+            return kBatchPreetham;
+        case kPreethamTable:
+            return kBatchPreethamTable;
+        case kPreethamBRDF:
+            return kBatchPreethamBRDF;
+
+        case kHosek:
+        case kHosekCubic:
+            return kBatchHosek;
+        case kHosekTable:
+        case kHosekCubicTable:
+            return kBatchHosekTable;
+        case kHosekBRDF:
+        case kHosekCubicBRDF:
+            return kBatchHosekBRDF;
+
+        default:
+            if (kCIEClear <= skyType && skyType <= kCIEStandard15)
+                return kBatchCIE;
+
+            return kBatchNone;
+        }
+    }
+}
+
+void SunSky::FusedSkyRGB(int numSkies, const SunSky* const skies[], const Vec3f* v, Vec3f* const rgb[], size_t n)
+{
+    const BatchKernels& kernels = SelectedBatchKernels();
+
+    // Set up models, ordered so each run of skies with the same sun direction is contiguous
+    std::vector<float>      results(numSkies * 3 * kBatchChunk);
+    std::vector<BatchModel> models;
+    std::vector<int>        modelSky;
+    std::vector<int>        groupStart;     // first model in each run
+
+    models.reserve(numSkies);
+    modelSky.reserve(numSkies);
+
+    for (int i = 0; i < numSkies; i++)
+    {
+        bool seen = false;
+
+        for (int j = 0; j < i && !seen; j++)
+            seen = (skies[j]->mToSun == skies[i]->mToSun);
+
+        if (seen)
+            continue;
+
+        groupStart.push_back(int(models.size()));
+
+        for (int j = i; j < numSkies; j++)
+        {
+            const SunSky& sky = *skies[j];
+
+            if (!(sky.mToSun == skies[i]->mToSun))
+                continue;
+
+            BatchModel m;
+
+            m.mType      = BatchModelFor(sky.mSkyType);
+            m.mPreetham  = &sky.mPreetham;
+            m.mHosek     = &sky.mHosek;
+            m.mCIE       = &sky.mCIE;
+            m.mTable     = &sky.mTable;
+            m.mBRDF      = &sky.mBRDF;
+            m.mRoughness = sky.mRoughness;
+
+            m.mR = results.data() + (3 * j + 0) * kBatchChunk;
+            m.mG = results.data() + (3 * j + 1) * kBatchChunk;
+            m.mB = results.data() + (3 * j + 2) * kBatchChunk;
+
+            models.push_back(m);
+            modelSky.push_back(j);
+        }
+    }
+
+    groupStart.push_back(int(models.size()));
+
+    float dx[kBatchChunk], dy[kBatchChunk], dz[kBatchChunk];
+    float cosGamma[kBatchChunk], gamma[kBatchChunk], zenith[kBatchChunk];
+
+    const BatchDirections dirs = { dz, cosGamma, gamma, zenith };
+
+    for (size_t i = 0; i < n; i += kBatchChunk)
+    {
+        size_t m = n - i < kBatchChunk ? n - i : kBatchChunk;
+
+        for (size_t j = 0; j < m; j++)
+        {
+            dx[j] = v[i + j].x;
+            dy[j] = v[i + j].y;
+            dz[j] = v[i + j].z;
+        }
+
+        for (size_t g = 0; g + 1 < groupStart.size(); g++)
+        {
+            int start = groupStart[g];
+            int count = groupStart[g + 1] - start;
+
+            kernels.mDirectionTerms(skies[modelSky[start]]->mToSun, dx, dy, dz, cosGamma, gamma, zenith, m);
+            kernels.mFusedRGB(models.data() + start, count, dirs, m);
+        }
+
+        for (int k = 0; k < numSkies; k++)
+        {
+            const float* r = results.data() + (3 * k + 0) * kBatchChunk;
+            const float* g = results.data() + (3 * k + 1) * kBatchChunk;
+            const float* b = results.data() + (3 * k + 2) * kBatchChunk;
+
+            for (size_t j = 0; j < m; j++)
+                rgb[k][i + j] = Vec3f(r[j], g[j], b[j]);
+        }
+    }
+}
+
 float SunSky::AverageLuminance() const
 {
     switch (mSkyType)
@@ -2082,6 +3285,22 @@ float SunSky::AverageLuminance() const
         return mZenithY;
     case kCIEPartlyCloudy:
         return CIEPartlyCloudySkyLuminance(Vec3f(0.0f, 0.0f, 0.0f), mToSun, mZenithY);
+    case kCIEStandard1:
+    case kCIEStandard2:
+    case kCIEStandard3:
+    case kCIEStandard4:
+    case kCIEStandard5:
+    case kCIEStandard6:
+    case kCIEStandard7:
+    case kCIEStandard8:
+    case kCIEStandard9:
+    case kCIEStandard10:
+    case kCIEStandard11:
+    case kCIEStandard12:
+    case kCIEStandard13:
+    case kCIEStandard14:
+    case kCIEStandard15:
+        return mZenithY;    // standard skies are normalised to the zenith
 
     case kHosek:
     case kHosekTable:
@@ -2095,3 +3314,176 @@ float SunSky::AverageLuminance() const
         return 1.0f;
     }
 }
+
+
+//------------------------------------------------------------------------------
+// SunSkyCache
+//------------------------------------------------------------------------------
+
+namespace
+{
+    // Returns v snapped to the nearest multiple of step, and sets key to identify it. A step of 0 leaves v as is.
+    float Quantize(float v, float step, int32_t* key)
+    {
+        if (step <= 0.0f)
+        {
+            memcpy(key, &v, sizeof(v));
+            return v;
+        }
+
+        *key = int32_t(floorf(v / step + 0.5f));
+        return *key * step;
+    }
+}
+
+bool SunSkyCache::Key::operator<(const Key& other) const
+{
+    if (mSkyType != other.mSkyType)
+        return mSkyType < other.mSkyType;
+    if (mGrid != other.mGrid)
+        return std::less<const SkyHosekGrid*>()(mGrid, other.mGrid);
+
+    return memcmp(mValues, other.mValues, sizeof(mValues)) < 0;
+}
+
+SunSkyCache::SunSkyCache(size_t maxEntries) :
+    mMaxEntries(maxEntries)
+{
+}
+
+void SunSkyCache::SetQuantization(float sunDir, float turbidity, float albedo, float overcast)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mSunDirStep    = sunDir;
+    mTurbidityStep = turbidity;
+    mAlbedoStep    = albedo;
+    mOvercastStep  = overcast;
+
+    mEntries.clear();
+    mIndex.clear();
+}
+
+void SunSkyCache::SetMaxEntries(size_t maxEntries)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mMaxEntries = maxEntries;
+    Trim();
+}
+
+bool SunSkyCache::Update(SunSky& sky)
+{
+    Key key = SnapSettings(sky);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        tIndex::iterator it = mIndex.find(key);
+
+        if (it != mIndex.end())
+        {
+            mEntries.splice(mEntries.begin(), mEntries, it->second);
+
+            float roughness = sky.Roughness();
+            sky = it->second->mSky;
+            sky.SetRoughness(roughness);
+
+            mHits++;
+            return true;
+        }
+
+        mMisses++;
+    }
+
+    // Build outside the lock, so other lookups aren't held up. If another thread is building the same state,
+    // the first to finish adds it.
+    sky.Update();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (mMaxEntries > 0 && mIndex.find(key) == mIndex.end())
+    {
+        mEntries.push_front(Entry{ key, sky });
+        mIndex[key] = mEntries.begin();
+
+        Trim();
+    }
+
+    return false;
+}
+
+size_t SunSkyCache::Hits() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHits;
+}
+
+size_t SunSkyCache::Misses() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mMisses;
+}
+
+size_t SunSkyCache::Size() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mEntries.size();
+}
+
+void SunSkyCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mEntries.clear();
+    mIndex.clear();
+
+    mHits   = 0;
+    mMisses = 0;
+}
+
+SunSkyCache::Key SunSkyCache::SnapSettings(SunSky& sky) const
+{
+    float sunDirStep, turbidityStep, albedoStep, overcastStep;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        sunDirStep    = mSunDirStep;
+        turbidityStep = mTurbidityStep;
+        albedoStep    = mAlbedoStep;
+        overcastStep  = mOvercastStep;
+    }
+
+    Key key;
+    key.mSkyType = sky.SkyType();
+    key.mGrid    = sky.HosekGrid();
+
+    Vec3f sunDir = sky.SunDir();
+    Vec3f albedo = sky.Albedo();
+
+    for (int i = 0; i < 3; i++)
+    {
+        sunDir[i] = Quantize(sunDir[i], sunDirStep, key.mValues + i);
+        albedo[i] = Quantize(albedo[i], albedoStep, key.mValues + 4 + i);
+    }
+
+    if (sunDirStep > 0.0f && sqrlen(sunDir) > 0.0f)
+        sunDir = norm(sunDir);
+
+    sky.SetSunDir   (sunDir);
+    sky.SetTurbidity(Quantize(sky.Turbidity(), turbidityStep, key.mValues + 3));
+    sky.SetAlbedo   (albedo);
+    sky.SetOvercast (Quantize(sky.Overcast(),  overcastStep,  key.mValues + 7));
+
+    return key;
+}
+
+void SunSkyCache::Trim()
+{
+    while (mEntries.size() > mMaxEntries)
+    {
+        mIndex.erase(mEntries.back().mKey);
+        mEntries.pop_back();
+    }
+}
@@ -14,6 +14,14 @@
 
 #include "VL234f.hpp"
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
 namespace SSLib
 {
     extern const float kSunDiameter;
@@ -37,6 +45,7 @@ namespace SSLib
     // Utilities
     Vec3f SunRGB(float cosTheta, float turbidity = 3.0f);   // Returns RGB for given sun elevation
     float ZenithLuminance(float thetaS, float T);           // Returns luminance estimate for given solar altitude and turbidity
+    const char* BatchISA();                                 // Returns the instruction set used by the batch evaluators, e.g., "avx2". See SunSkyKernels.h
 
     float CIEOvercastSkyLuminance    (const Vec3f& v, float Lz);                        // CIE standard overcast sky
     float CIEClearSkyLuminance       (const Vec3f& v, const Vec3f& toSun, float Lz);    // CIE standard clear sky
@@ -44,6 +53,69 @@ namespace SSLib
     float CIEStandardSky   (int type, const Vec3f& v, const Vec3f& toSun, float Lz);    // Returns one of 15 standard skies: type = 0-14. See kCIEStandardSkyCoeffs
 
 
+    //--------------------------------------------------------------------------
+    // SkyDirection
+    //--------------------------------------------------------------------------
+
+    struct SkyDirection
+    {
+        // Direction-dependent terms shared by the analytic sky models, for a given sun direction. Preparing these
+        // once lets several models, or several states of one model, with the same sun direction be evaluated for
+        // a direction without each recomputing them. (The table-based models only need cos(theta) and cos(gamma),
+        // which are trivial, so just use mDir.)
+        SkyDirection() {}
+        SkyDirection(const Vec3f& v, const Vec3f& toSun);   // v must be normalized
+
+        Vec3f       mDir;
+        float       mCosTheta;      // cos of zenith angle, clamped to >= 0
+        float       mCosGamma;      // cos of angle to sun
+        float       mGamma;         // angle to sun
+        float       mZenith;        // sqrt(mCosTheta)
+    };
+
+
+    //--------------------------------------------------------------------------
+    // SkyCIE
+    //--------------------------------------------------------------------------
+
+    enum tCIESkyType
+    {
+        kCIESkyClear,           // As CIEClearSkyLuminance
+        kCIESkyOvercast,        // As CIEOvercastSkyLuminance
+        kCIESkyPartlyCloudy,    // As CIEPartlyCloudySkyLuminance
+        kCIESkyStandard1,       // As CIEStandardSky, types 0-14
+        kCIESkyStandard15 = kCIESkyStandard1 + 14,
+        kNumCIESkyTypes
+    };
+
+    class SkyCIE
+    {
+    public:
+        // Equivalent to the CIE functions above, but with all sun-dependent terms calculated once in Update().
+        // All models are expressed in the form
+        //   Lz (h0 + h1 e ^ (h2 / cos(t))) (g0 + g1 e ^ (g2 g) + g3 cos(g) ^ 2) / (normalisation)
+        // apart from the older overcast model, which is linear in cos(t).
+        SkyCIE();
+
+        void        Update(const Vec3f& sun, float zenithLum, tCIESkyType type);   // update model with given settings
+
+        float       SkyLuminance(const Vec3f& v) const;    // Returns the luminance of the sky in direction v. v must be normalized.
+        float       SkyLuminance(const SkyDirection& d) const;   // As above, with d prepared for mToSun
+
+        // Batch version of the above, taking n directions in SoA form, and evaluated in SIMD lanes.
+        void        SkyLuminance(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const;
+
+        // Data
+        Vec3f       mToSun;
+        tCIESkyType mType;
+        float       mGradation[3];      // h0, h1, h2: dependence on view zenith angle t
+        float       mIndicatrix[4];     // g0, g1, g2, g3: dependence on angle to sun g
+        float       mScale;             // Lz / normalisation. Depends only on the sun.
+        bool        mClampHorizon;      // Whether to clamp cos(t) to >= 0
+        bool        mLinear;            // Older overcast model: mScale (1 + 2 cos(t))
+    };
+
+
     //--------------------------------------------------------------------------
     // SkyPreetham
     //--------------------------------------------------------------------------
@@ -59,6 +131,17 @@ namespace SSLib
         float       SkyLuminance(const Vec3f &v) const;     // Returns the luminance of the sky in direction v. v must be normalized. Luminance is in Nits = cd/m^2 = lumens/sr/m^2 */
         Vec2f       SkyChroma   (const Vec3f &v) const;     // Returns the chroma of the sky in direction v. v must be normalized.
 
+        // Versions of the above with d prepared for mToSun
+        Vec3f       SkyRGB      (const SkyDirection& d) const;
+        float       SkyLuminance(const SkyDirection& d) const;
+        Vec2f       SkyChroma   (const SkyDirection& d) const;
+
+        // Batch versions of the above, taking n directions in SoA form, and evaluated in SIMD lanes.
+        // Results match the per-sample versions to within 1e-4 relative, and typically 1e-6. (The worst
+        // case is right next to the sun, where acos(cos gamma) is ill-conditioned.)
+        void        SkyRGB      (const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const;
+        void        SkyLuminance(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const;
+
         // Data
         Vec3f       mToSun;
 
@@ -68,6 +151,12 @@ namespace SSLib
 
         Vec3f       mZenith;
         Vec3f       mPerezInvDen;
+
+        // Settings of the last Update(). The sun only affects the Perez coefficients via mSunset.
+        float       mTurbidity  = 0.0f;
+        float       mOvercast   = 0.0f;
+        float       mHorizCrush = 0.0f;
+        float       mSunset     = 1.0f;     // Scale on the C and E terms as the sun sets, 1 above the horizon
     };
 
 
@@ -75,6 +164,8 @@ namespace SSLib
     // SkyHosek
     //--------------------------------------------------------------------------
 
+    class SkyHosekGrid;
+
     class SkyHosek
     {
     public:
@@ -86,12 +177,90 @@ namespace SSLib
         Vec3f       SkyRGB      (const Vec3f &v) const;     // Returns luminance/chroma converted to RGB
         float       SkyLuminance(const Vec3f &v) const;     // Returns CIE XYZ
 
+        // Versions of the above with d prepared for mToSun
+        Vec3f       SkyXYZ      (const SkyDirection& d) const;
+        Vec3f       SkyRGB      (const SkyDirection& d) const;
+        float       SkyLuminance(const SkyDirection& d) const;
+
+        // Batch versions of the above, taking n directions in SoA form, and evaluated in SIMD lanes.
+        // Results match the per-sample versions to within 1e-4 relative, and typically 1e-6. (The worst
+        // case is right next to the sun, where acos(cos gamma) is ill-conditioned.)
+        void        SkyXYZ(const float* dx, const float* dy, const float* dz, float* X, float* Y, float* Z, size_t n) const;
+        void        SkyRGB(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const;
+        void        SkyLuminance(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const;
+
         // Data
         Vec3f       mToSun;
         float       mCoeffsXYZ[3][9];   // Hosek 9-term distribution coefficients
         Vec3f       mRadXYZ;            // Overall average radiance
         Vec3f       mAlbedo;            // Ground albedo
         bool        mUseCubic = false;  // Whether to use approximated cut-down Hosek
+
+        // Per-channel elevation control points, pre-blended over turbidity and albedo, so that Update()
+        // only has to evaluate the elevation basis when just the sun moves. Quintic uses all 6 points,
+        // cubic the first 4. The first 9 entries of each are the coefficients, the last the radiance.
+        float       mControlXYZ[3][6][10];
+        float       mControlTurbidity = -1.0f;  // Settings mControlXYZ was found for
+        Vec3f       mControlAlbedo    = vl_0;
+        bool        mControlCubic     = false;
+
+        const SkyHosekGrid* mGrid = 0;  // If set, and built for mUseCubic, Update() looks coefficients up here rather than evaluating the model
+    };
+
+
+    //--------------------------------------------------------------------------
+    // SkyHosekGrid
+    //--------------------------------------------------------------------------
+
+    class SkyHosekGrid
+    {
+    public:
+        // Precomputed SkyHosek coefficients and radiance over sun height x turbidity x albedo, which
+        // reduces SkyHosek::Update() to a trilinear fetch. This includes the fade below the horizon, but
+        // not overcast, which depends on the full sun direction, and so is still applied afterwards.
+        // The saved form is a versioned header followed by the grid as flat floats, so it can also be
+        // used in place, e.g., from a memory-mapped file.
+        SkyHosekGrid() = default;
+        SkyHosekGrid(const SkyHosekGrid&) = delete;
+        SkyHosekGrid& operator=(const SkyHosekGrid&) = delete;
+
+        void        Build(bool cubic, int numElevations = 64, int numTurbidities = 19);    // Build from the Hosek model, or its cubic approximation
+
+        bool        Load  (const char* path);               // Load grid written by Save(). Fails on a missing, corrupt, or out-of-date file
+        bool        Save  (const char* path) const;
+        bool        Attach(const void* data, size_t size);  // Use saved grid in place. data must be 4-byte aligned, and outlive any use of the grid
+
+        bool        Valid() const;          // Returns whether grid has been built or loaded
+        bool        Cubic() const;          // Returns whether grid is for the cubic approximation
+        size_t      Size() const;           // Returns size of saved form in bytes
+
+        void        Find(float sunZ, float turbidity, const Vec3f& albedoXYZ, float coeffs[3][9], Vec3f& rad) const;   // As SkyHosek::Update(), minus overcast
+
+        enum { kVersion = 1, kEntrySize = 10 };     // Entry is 9 coefficients, then radiance
+
+        struct Header
+        {
+            char        mMagic[4];          // "SSHG"
+            uint32_t    mVersion;           // kVersion
+            uint32_t    mCubic;
+            uint32_t    mNumBelow;          // Sun heights below the horizon, uniform in sun z over [mMinSunZ, 0)
+            uint32_t    mNumAbove;          // Sun heights from the horizon up, uniform in the elevation basis parameter, (elevation / halfPi)^(1/3)
+            uint32_t    mNumTurbidities;    // Uniform over [mMinTurbidity, mMaxTurbidity]
+            uint32_t    mNumAlbedos;        // Uniform over [0, 1]. The model is linear in albedo, so 2 suffice
+            float       mMinSunZ;
+            float       mMinTurbidity;
+            float       mMaxTurbidity;
+            uint32_t    mReserved[2];
+        };
+        // Header is followed by float[mNumBelow + mNumAbove][mNumTurbidities][mNumAlbedos][3][kEntrySize]
+
+    protected:
+        bool        Use(const void* data, size_t size);
+        size_t      NumFloats() const;
+
+        Header      mHeader = {};
+        const float* mData  = 0;
+        std::vector<float> mStorage;        // Built grid, or loaded file, unless attached
     };
 
 
@@ -117,6 +286,10 @@ namespace SSLib
         Vec3f       SkyRGB(const SkyPreetham& pt, const Vec3f& v) const;  // Use precalculated table to return fast sky colour on CPU
         Vec3f       SkyRGB(const SkyHosek& hk,    const Vec3f& v) const;  // Use precalculated table to return fast sky colour on CPU
 
+        // Batch versions of the above, taking n directions in SoA form, and evaluated in SIMD lanes via the SoA tables
+        void        SkyRGB(const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const;
+        void        SkyRGB(const SkyHosek& hk,    const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const;
+
         void        FillTexture(int width, int height, uint8_t image[][4]) const;  // Fill kTableSize x 2 BGRA8 texture with tables
         void        FillTexture(int width, int height, float   image[][4]) const;  // Fill kTableSize x 2 RGBAF32 texture with tables
 
@@ -127,6 +300,25 @@ namespace SSLib
         float       mMaxTheta = 1.0f;       // To avoid clipping when using non-float textures. Currently only necessary if overcast is being used.
         float       mMaxGamma = 1.0f;       // To avoid clipping when using non-float textures.
         bool        mXYZ      = false;      // Whether tables are storing xyY (Preetham) or XYZ (Hosek)
+
+        // SoA copies of the above tables for gather-based batch lookups. These aren't over-aligned, as SunSky is
+        // kept in standard containers, and the batch code only uses unaligned loads.
+        float       mThetaTableSoA[3][kTableSize];
+        float       mGammaTableSoA[3][kTableSize];
+
+        // Preetham tables for the sun above the horizon. These depend only on the turbidity, overcast and
+        // horizon crush they were found for, and the sun setting just scales the gamma table.
+        Vec3f       mBaseThetaTable[kTableSize];
+        Vec3f       mBaseGammaTable[kTableSize];
+        float       mBaseMaxTheta;
+        float       mBaseMaxGamma;
+        float       mBaseTurbidity  = -1.0f;    // Settings the base tables are for. -1 = none yet
+        float       mBaseOvercast   = 0.0f;
+        float       mBaseHorizCrush = 0.0f;
+
+    protected:
+        void        FindBaseTables(const SkyPreetham& pt);
+        void        UpdateSoATables();
     };
 
 
@@ -150,6 +342,10 @@ namespace SSLib
         Vec3f       ConvolvedSkyRGB(const SkyPreetham& pt, const Vec3f& v, float roughness) const; // return sky term convolved with roughness, 1 = fully diffuse
         Vec3f       ConvolvedSkyRGB(const SkyHosek& pt,    const Vec3f& v, float roughness) const; // return sky term convolved with roughness, 1 = fully diffuse
 
+        // Batch versions of the above, taking n directions in SoA form, each with its own roughness, and evaluated in SIMD lanes via the SoA tables
+        void        ConvolvedSkyRGB(const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n) const;
+        void        ConvolvedSkyRGB(const SkyHosek& hk,    const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n) const;
+
         void        FillBRDFTexture(int width, int height, uint8_t image[][4]) const; // Fill kTableSize x (kBRDFSamples x 2|4) BGRA8 texture with tables
         void        FillBRDFTexture(int width, int height, float   image[][4]) const; // Fill kTableSize x (kBRDFSamples x 2|4) RGBAF32 texture with tables
                     // Note: for Hosek, the H term will be in the 'w' component of the theta section, and if a kBRDFSamples x 4 size texture is supplied,
@@ -172,6 +368,14 @@ namespace SSLib
         float       mMaxTheta = 1.0f;       // To avoid clipping when using non-float textures. Currently only necessary if overcast is being used.
         float       mMaxGamma = 1.0f;       // To avoid clipping when using non-float textures.
         bool        mXYZ      = false;      // Whether tables are storing xyY (Preetham) or XYZ (Hosek)
+
+        // SoA copies of the Vec3f tables above for gather-based batch lookups. (mBRDFThetaTableH is already in this form.)
+        float       mBRDFThetaTableSoA  [3][kBRDFSamples * kTableSize];
+        float       mBRDFGammaTableSoA  [3][kBRDFSamples * kTableSize];
+        float       mBRDFThetaTableFHSoA[3][kBRDFSamples * kTableSize];
+
+    protected:
+        void        UpdateSoATables();
     };
 
 
@@ -194,6 +398,21 @@ namespace SSLib
         kCIEClear,
         kCIEOvercast,
         kCIEPartlyCloudy,
+        kCIEStandard1,  // The fifteen Darula & Kittler standard skies, see kCIEStandardSkyCoeffs
+        kCIEStandard2,
+        kCIEStandard3,
+        kCIEStandard4,
+        kCIEStandard5,
+        kCIEStandard6,
+        kCIEStandard7,
+        kCIEStandard8,
+        kCIEStandard9,
+        kCIEStandard10,
+        kCIEStandard11,
+        kCIEStandard12,
+        kCIEStandard13,
+        kCIEStandard14,
+        kCIEStandard15,
         kNumSkyTypes
     };
 
@@ -210,18 +429,69 @@ namespace SSLib
         void        SetAlbedo   (Vec3f rgb);  // Set ground-bounce factor
         void        SetOvercast (float overcast);   // 0 = clear, 1 = completely overcast
         void        SetRoughness(float roughness);  // Set roughness for BRDF tables
+        void        SetHosekGrid(const SkyHosekGrid* grid);    // Use precomputed grid for Hosek types it was built for, or 0 for none. Must outlive its use here
+
+        const Vec3f& SunDir() const;                // Returns sun direction, e.g., for preparing SkyDirections
+        float       Turbidity() const;
+        const Vec3f& Albedo() const;
+        float       Overcast() const;
+        float       Roughness() const;
+        const SkyHosekGrid* HosekGrid() const;
 
-        void        Update();                       // update model given above settings
+        void        Update();                       // update model given above settings, rebuilding only what's changed and in use
 
         float       SkyLuminance(const Vec3f &v) const;     // Returns the luminance of the sky in direction v. v must be normalized. Luminance is in Nits = cd/m^2 = lumens/sr/m^2 */
         Vec2f       SkyChroma   (const Vec3f &v) const;     // Returns the chroma of the sky in direction v. v must be normalized.
         Vec3f       SkyRGB      (const Vec3f &v) const;     // Returns luminance/chroma converted to RGB
 
+        // Batch versions of the above for n directions. These switch on the sky type once per call rather than per
+        // sample, and then evaluate via the SIMD batch path for that model.
+        void        SkyLuminance(const Vec3f* v, float* lum, size_t n) const;
+        void        SkyRGB      (const Vec3f* v, Vec3f* rgb, size_t n) const;
+
+        // SoA version of SkyRGB, for directions that are already in that form, e.g., cached per-pixel directions
+        void        SkyRGB      (const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const;
+
+        // Versions of the per-sample functions with d prepared for the current sun direction
+        float       SkyLuminance(const SkyDirection& d) const;
+        Vec3f       SkyRGB      (const SkyDirection& d) const;
+
+        // Evaluates numSkies skies for the same n directions, with sky i's results going to rgb[i]. This is done in
+        // one pass over the directions, with the direction terms (including acos(cos gamma)) found once for all skies
+        // with the same sun direction. Results are identical to calling SkyRGB() on each sky.
+        static void FusedSkyRGB(int numSkies, const SunSky* const skies[], const Vec3f* v, Vec3f* const rgb[], size_t n);
+
+        // Returns RGB for n SoA directions, each with its own roughness. For the BRDF types this uses the batch
+        // SkyBRDF path, other types ignore roughness.
+        void        ConvolvedSkyRGB(const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n) const;
+
         float       AverageLuminance() const;
 
     protected:
+        template<tSkyType T> void SkyLuminanceBatch(const Vec3f* v, float* lum, size_t n) const;
+        template<tSkyType T> void SkyRGBBatch      (const Vec3f* v, Vec3f* rgb, size_t n) const;
+        template<tSkyType T> void SkyRGBBatchSoA   (const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const;
+
+        template<tSkyType T> void SkyLuminanceSoA(const float* dx, const float* dy, const float* dz, float* lum, size_t n) const;
+        template<tSkyType T> void SkyRGBSoA      (const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n) const;
+
+        // Parts of the model rebuilt by Update(). See kSkyTypeParts for which are used by each sky type.
+        enum tPart
+        {
+            kPartZenith   = 1 << 0,     // mZenithY
+            kPartCIE      = 1 << 1,
+            kPartPreetham = 1 << 2,
+            kPartHosek    = 1 << 3,
+            kPartTable    = 1 << 4,
+            kPartBRDF     = 1 << 5,
+            kPartAll      = (1 << 6) - 1
+        };
+
+        static const int kSkyTypeParts[kNumSkyTypes];
+
         // Data
         tSkyType    mSkyType;
+        int         mStale;     // tParts whose settings have changed since they were last built
 
         Vec3f       mToSun;
         float       mTurbidity;
@@ -234,9 +504,72 @@ namespace SSLib
 
         SkyPreetham mPreetham;
         SkyHosek    mHosek;
+        SkyCIE      mCIE;
         SkyTable    mTable;
         SkyBRDF     mBRDF;
     };
+
+
+    //--------------------------------------------------------------------------
+    // SunSkyCache
+    //--------------------------------------------------------------------------
+
+    class SunSkyCache
+    {
+    public:
+        // Bounded LRU cache of updated SunSky states, for when the same states are requested over and over, and
+        // worth it mainly for the BRDF types. Lookup is by sky type and the other settings quantized to the given
+        // steps. (A step of 0 requires an exact match.) A sky updated via the cache has its settings snapped to
+        // those steps first, so the result is the same whether or not it's a hit. Roughness isn't part of the
+        // key, as it's only used at evaluation time. Thread-safe.
+        explicit SunSkyCache(size_t maxEntries = 256);
+
+        void        SetQuantization(float sunDir, float turbidity, float albedo, float overcast);   // Set steps. Clears cache
+        void        SetMaxEntries(size_t maxEntries);       // Evicts least-recently used entries as necessary
+
+        bool        Update(SunSky& sky);    // As sky.Update(), but copying the updated model from the cache if present. Returns whether it was
+
+        size_t      Hits() const;
+        size_t      Misses() const;
+        size_t      Size() const;           // Returns number of entries
+        void        Clear();                // Empties cache and resets counters
+
+    protected:
+        struct Key
+        {
+            int         mSkyType;
+            int32_t     mValues[8];     // quantized sun direction, turbidity, albedo, overcast
+            const SkyHosekGrid* mGrid;
+
+            bool operator<(const Key& other) const;
+        };
+
+        struct Entry
+        {
+            Key         mKey;
+            SunSky      mSky;
+        };
+
+        typedef std::list<Entry>            tEntries;
+        typedef std::map<Key, tEntries::iterator> tIndex;
+
+        Key         SnapSettings(SunSky& sky) const;    // Quantizes sky's settings, and returns the corresponding key
+        void        Trim();                             // Evicts entries over mMaxEntries. Expects lock to be held
+
+        mutable std::mutex mMutex;
+
+        tEntries    mEntries;       // Most recently used first
+        tIndex      mIndex;
+        size_t      mMaxEntries;
+
+        float       mSunDirStep    = 0.0f;
+        float       mTurbidityStep = 0.0f;
+        float       mAlbedoStep    = 0.0f;
+        float       mOvercastStep  = 0.0f;
+
+        size_t      mHits   = 0;
+        size_t      mMisses = 0;
+    };
 }
 
 #endif
@@ -0,0 +1,143 @@
+//
+// SunSkyKernels.cpp
+//
+// Baseline build of the batch kernels, plus selection of the best version for
+// the current CPU. See SunSkyKernels.h.
+//
+
+#include "SunSkyKernels.inl"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+    #define strcasecmp _stricmp
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define SS_X86
+#endif
+
+const BatchKernels* SSLib::BatchKernelsBase()
+{
+    return &kKernels;
+}
+
+namespace
+{
+#ifdef SS_X86
+    void CPUID(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+    {
+    #if defined(_MSC_VER)
+        int r[4];
+        __cpuidex(r, int(leaf), int(subleaf));
+        for (int i = 0; i < 4; i++)
+            regs[i] = uint32_t(r[i]);
+    #else
+        __asm__ __volatile__("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(subleaf));
+    #endif
+    }
+
+    uint64_t XGETBV()   // which register state the OS saves on context switch
+    {
+    #if defined(_MSC_VER)
+        return _xgetbv(0);
+    #else
+        uint32_t lo, hi;
+        __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return (uint64_t(hi) << 32) | lo;
+    #endif
+    }
+
+    struct CPUFeatures
+    {
+        bool mSSE4   = false;
+        bool mAVX2   = false;   // + FMA
+        bool mAVX512 = false;
+    };
+
+    CPUFeatures FindCPUFeatures()
+    {
+        CPUFeatures f;
+        uint32_t r[4];
+
+        CPUID(0, 0, r);
+        uint32_t maxLeaf = r[0];
+
+        CPUID(1, 0, r);
+        uint32_t ecx1 = r[2];
+
+        f.mSSE4 = (ecx1 & (1 << 19)) && (ecx1 & (1 << 20));
+
+        bool osxsave = (ecx1 & (1 << 27)) != 0;
+        bool avx     = (ecx1 & (1 << 28)) != 0;
+        bool fma     = (ecx1 & (1 << 12)) != 0;
+
+        if (!osxsave || !avx || maxLeaf < 7)
+            return f;
+
+        uint64_t xcr0 = XGETBV();
+
+        CPUID(7, 0, r);
+        uint32_t ebx7 = r[1];
+
+        f.mAVX2   = (xcr0 & 0x06) == 0x06 && (ebx7 & (1 << 5)) && fma;       // XMM + YMM state
+        f.mAVX512 = (xcr0 & 0xE6) == 0xE6 && (ebx7 & (1 << 16));             // + opmask, ZMM state
+
+        return f;
+    }
+#endif
+
+    const BatchKernels* FindBatchKernels()
+    {
+        const BatchKernels* candidates[] =  // in order of preference
+        {
+        #ifdef SS_X86
+            BatchKernelsAVX512(),
+            BatchKernelsAVX2(),
+            BatchKernelsSSE4(),
+        #endif
+            BatchKernelsBase(),
+            BatchKernelsScalar()
+        };
+        const int numCandidates = sizeof(candidates) / sizeof(candidates[0]);
+
+        bool supported[numCandidates];
+
+        for (int i = 0; i < numCandidates; i++)
+            supported[i] = candidates[i] != 0;
+
+    #ifdef SS_X86
+        CPUFeatures cpu = FindCPUFeatures();
+
+        supported[0] = supported[0] && cpu.mAVX512;
+        supported[1] = supported[1] && cpu.mAVX2;
+        supported[2] = supported[2] && cpu.mSSE4;
+    #endif
+
+        const char* forced = getenv("SUNSKY_SIMD");
+
+        if (forced && forced[0])
+        {
+            for (int i = 0; i < numCandidates; i++)
+                if (supported[i] && strcasecmp(candidates[i]->mName, forced) == 0)
+                    return candidates[i];
+
+            fprintf(stderr, "SunSky: SUNSKY_SIMD=%s not available, using default\n", forced);
+        }
+
+        for (int i = 0; i < numCandidates; i++)
+            if (supported[i])
+                return candidates[i];
+
+        return BatchKernelsBase();
+    }
+}
+
+const BatchKernels& SSLib::SelectedBatchKernels()
+{
+    static const BatchKernels* sKernels = FindBatchKernels();   // thread-safe init as of C++11
+    return *sKernels;
+}
@@ -0,0 +1,105 @@
+//
+//  SunSkyKernels.h
+//
+//  Runtime dispatch of the batch (SoA/SIMD) sky evaluators. The kernels in
+//  SunSkyKernels.inl are compiled once per instruction set, each in its own
+//  SunSkyKernels*.cpp, and the best one the CPU supports is picked on first
+//  use. Internal to SunSky.cpp -- not part of the public API.
+//
+//  Per-file flags for x86 (see Makefile):
+//    SunSkyKernelsSSE4.cpp     -msse4.2
+//    SunSkyKernelsAVX2.cpp     -mavx2 -mfma
+//    SunSkyKernelsAVX512.cpp   -mavx512f
+//  A file built without its flags compiles to a stub, and dispatch skips it.
+//  On ARM64 the baseline build in SunSkyKernels.cpp is NEON.
+//
+//  Set the environment variable SUNSKY_SIMD to one of "scalar", "sse2",
+//  "sse4", "avx2", "avx512" or "neon" to force a particular version, e.g.,
+//  for testing. Unavailable choices fall back to the default selection.
+//
+
+#ifndef SUN_SKY_KERNELS_H
+#define SUN_SKY_KERNELS_H
+
+#include "SunSky.hpp"
+
+// Configuration, shared by SunSky.cpp and the batch kernels
+// #define SIM_CLAMP                // emulate normalised integer texture, for CPU-side checking
+// #define SUPPORT_OVERCAST_CLAMP   // support overcast functionality via tables. (Without overcast, the theta table is within 0-1 anyway.)
+#define REMAP_THETA                 // remap cos theta to concentrate table around horizon
+#define HOSEK_G_FIX                 // fixes hue ringing during sunset/sunrise with BRDF version of Hosek, causing blue spots opposite
+// #define HOSEK_BRDF_ANALYTIC_H    // for A/B'ing H/FH tables vs. direct ZH evaluation
+// #define LOCAL_DEBUG              // dump debug/tuning info
+
+namespace SSLib
+{
+    enum tBatchModel
+    {
+        kBatchNone,
+        kBatchPreetham,
+        kBatchPreethamTable,
+        kBatchPreethamBRDF,
+        kBatchHosek,
+        kBatchHosekTable,
+        kBatchHosekBRDF,
+        kBatchCIE
+    };
+
+    struct BatchModel           // One model in a fused evaluation, see mFusedRGB
+    {
+        tBatchModel         mType       = kBatchNone;
+
+        const SkyPreetham*  mPreetham   = 0;
+        const SkyHosek*     mHosek      = 0;
+        const SkyCIE*       mCIE        = 0;
+        const SkyTable*     mTable      = 0;
+        const SkyBRDF*      mBRDF       = 0;
+        float               mRoughness  = 0.0f;
+
+        float*              mR          = 0;    // Output
+        float*              mG          = 0;
+        float*              mB          = 0;
+    };
+
+    struct BatchDirections      // SoA equivalent of SkyDirection, from mDirectionTerms
+    {
+        const float*        mZ;
+        const float*        mCosGamma;
+        const float*        mGamma;
+        const float*        mZenith;
+    };
+
+    struct BatchKernels
+    {
+        const char* mName;
+
+        void (*mCIELuminance)     (const SkyCIE& cie,     const float* dx, const float* dy, const float* dz, float* lum, size_t n);
+        void (*mPreethamRGB)      (const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n);
+        void (*mPreethamLuminance)(const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, float* lum, size_t n);
+        void (*mHosekXYZ)         (const SkyHosek& hk,    const float* dx, const float* dy, const float* dz, float* X, float* Y, float* Z, size_t n);
+        void (*mHosekRGB)         (const SkyHosek& hk,    const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n);
+        void (*mHosekLuminance)   (const SkyHosek& hk,    const float* dx, const float* dy, const float* dz, float* lum, size_t n);
+
+        void (*mTablePreethamRGB) (const SkyTable& table, const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n);
+        void (*mTableHosekRGB)    (const SkyTable& table, const SkyHosek& hk,    const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n);
+
+        void (*mBRDFPreethamRGB)  (const SkyBRDF& brdf, const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n);
+        void (*mBRDFHosekRGB)     (const SkyBRDF& brdf, const SkyHosek& hk,    const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n);
+
+        // Fused evaluation: find the shared direction terms for a given sun direction once, then evaluate any
+        // number of models using that sun direction from them.
+        void (*mDirectionTerms)   (const Vec3f& toSun, const float* dx, const float* dy, const float* dz, float* cosGamma, float* gamma, float* zenith, size_t n);
+        void (*mFusedRGB)         (const BatchModel* models, int numModels, const BatchDirections& dirs, size_t n);
+    };
+
+    // Per-instruction-set versions, null if not built
+    const BatchKernels* BatchKernelsScalar();
+    const BatchKernels* BatchKernelsBase();     // default target flags: SSE2 on x86-64, NEON on ARM64
+    const BatchKernels* BatchKernelsSSE4();
+    const BatchKernels* BatchKernelsAVX2();
+    const BatchKernels* BatchKernelsAVX512();
+
+    const BatchKernels& SelectedBatchKernels(); // Best version for this CPU, chosen on first call
+}
+
+#endif
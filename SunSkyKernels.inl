@@ -0,0 +1,973 @@
+//
+// SunSkyKernels.inl
+//
+// Batch versions of the sky model evaluators, taking directions in SoA form
+// and evaluating them in SIMD lanes. This is included once per instruction
+// set by the SunSkyKernels*.cpp files -- see SunSkyKernels.h. Everything here
+// must have internal linkage, and avoid instantiating VL inlines.
+//
+
+#include "SunSkyKernels.h"
+#include "SunSkyMath.h"
+
+#include <float.h>
+
+using namespace SSLib;
+
+//------------------------------------------------------------------------------
+// Common
+//------------------------------------------------------------------------------
+
+namespace
+{
+    using namespace SSLib::SIMD;
+    using namespace SSLib::Math;
+
+    // XYZ to sRGB, as kXYZToR/G/B in SunSky.cpp. (Plain floats, so nothing
+    // here instantiates VL inlines, which would be built for this file's ISA.)
+    const float kXYZToRGB[3][3] =
+    {
+        {  3.2404542f, -1.5371385f, -0.4985314f },
+        { -0.9692660f,  1.8760108f,  0.0415560f },
+        {  0.0556434f, -0.2040259f,  1.0572252f }
+    };
+
+    // Runs kernel(x, y, z, out0, out1, out2) over n SoA directions, VFloat::kWidth at a time,
+    // using partial loads/stores for any remainder.
+    template<class T_KERNEL> void ForEachBlock
+    (
+        const float* dx, const float* dy, const float* dz,
+        float* o0, float* o1, float* o2,
+        size_t n,
+        T_KERNEL kernel
+    )
+    {
+        const size_t kW = VFloat::kWidth;
+        size_t i = 0;
+
+        for ( ; i + kW <= n; i += kW)
+        {
+            VFloat c0, c1, c2;
+            kernel(Load(dx + i), Load(dy + i), Load(dz + i), c0, c1, c2);
+
+            Store(o0 + i, c0);
+            Store(o1 + i, c1);
+            Store(o2 + i, c2);
+        }
+
+        if (i < n)
+        {
+            size_t count = n - i;
+
+            VFloat c0, c1, c2;
+            kernel(LoadPartial(dx + i, count), LoadPartial(dy + i, count), LoadPartial(dz + i, count), c0, c1, c2);
+
+            StorePartial(o0 + i, c0, count);
+            StorePartial(o1 + i, c1, count);
+            StorePartial(o2 + i, c2, count);
+        }
+    }
+
+    // Single-output version of the above
+    template<class T_KERNEL> void ForEachBlock
+    (
+        const float* dx, const float* dy, const float* dz,
+        float* o0,
+        size_t n,
+        T_KERNEL kernel
+    )
+    {
+        const size_t kW = VFloat::kWidth;
+        size_t i = 0;
+
+        for ( ; i + kW <= n; i += kW)
+        {
+            VFloat c0;
+            kernel(Load(dx + i), Load(dy + i), Load(dz + i), c0);
+
+            Store(o0 + i, c0);
+        }
+
+        if (i < n)
+        {
+            size_t count = n - i;
+
+            VFloat c0;
+            kernel(LoadPartial(dx + i, count), LoadPartial(dy + i, count), LoadPartial(dz + i, count), c0);
+
+            StorePartial(o0 + i, c0, count);
+        }
+    }
+
+    // Version of the above with an additional per-direction input, w
+    template<class T_KERNEL> void ForEachBlock
+    (
+        const float* dx, const float* dy, const float* dz, const float* dw,
+        float* o0, float* o1, float* o2,
+        size_t n,
+        T_KERNEL kernel
+    )
+    {
+        const size_t kW = VFloat::kWidth;
+        size_t i = 0;
+
+        for ( ; i + kW <= n; i += kW)
+        {
+            VFloat c0, c1, c2;
+            kernel(Load(dx + i), Load(dy + i), Load(dz + i), Load(dw + i), c0, c1, c2);
+
+            Store(o0 + i, c0);
+            Store(o1 + i, c1);
+            Store(o2 + i, c2);
+        }
+
+        if (i < n)
+        {
+            size_t count = n - i;
+
+            VFloat c0, c1, c2;
+            kernel(LoadPartial(dx + i, count), LoadPartial(dy + i, count), LoadPartial(dz + i, count), LoadPartial(dw + i, count), c0, c1, c2);
+
+            StorePartial(o0 + i, c0, count);
+            StorePartial(o1 + i, c1, count);
+            StorePartial(o2 + i, c2, count);
+        }
+    }
+
+    struct Mat3Lanes    // 3x3 colour transform broadcast across lanes
+    {
+        Mat3Lanes(const float m[3][3]) :
+            m00(m[0][0]), m01(m[0][1]), m02(m[0][2]),
+            m10(m[1][0]), m11(m[1][1]), m12(m[1][2]),
+            m20(m[2][0]), m21(m[2][1]), m22(m[2][2])
+        {}
+
+        void Apply(VFloat& a, VFloat& b, VFloat& c) const
+        {
+            VFloat ra = m00 * a + m01 * b + m02 * c;
+            VFloat rb = m10 * a + m11 * b + m12 * c;
+            VFloat rc = m20 * a + m21 * b + m22 * c;
+
+            a = ra;
+            b = rb;
+            c = rc;
+        }
+
+        VFloat m00, m01, m02;
+        VFloat m10, m11, m12;
+        VFloat m20, m21, m22;
+    };
+}
+
+//------------------------------------------------------------------------------
+// SkyCIE
+//------------------------------------------------------------------------------
+
+namespace
+{
+    struct CIELanes     // SkyCIE parameters, broadcast across lanes
+    {
+        CIELanes(const SkyCIE& cie) :
+            linear(cie.mLinear),
+            scale(cie.mScale),
+            h0(cie.mGradation [0]), h1(cie.mGradation [1]), h2(cie.mGradation [2]),
+            g0(cie.mIndicatrix[0]), g1(cie.mIndicatrix[1]), g2(cie.mIndicatrix[2]), g3(cie.mIndicatrix[3]),
+            minCosTheta(cie.mClampHorizon ? 0.0f : -FLT_MAX)
+        {}
+
+        VFloat Luminance(VFloat vz, VFloat cosGamma, VFloat gamma) const
+        {
+            if (linear)
+                return scale * MulAdd(2.0f, vz, 1.0f);
+
+            VFloat cosThetaV = Max(vz, minCosTheta);
+
+            VFloat top1 = h0 + h1 * Exp(h2 / (cosThetaV + 1e-6f));
+            VFloat top2 = g0 + g1 * Exp(g2 * gamma) + g3 * cosGamma * cosGamma;
+
+            return scale * top1 * top2;
+        }
+
+        bool   linear;
+        VFloat scale;
+        VFloat h0, h1, h2;
+        VFloat g0, g1, g2, g3;
+        VFloat minCosTheta;
+    };
+
+    void CIELuminance(const SkyCIE& cie, const float* dx, const float* dy, const float* dz, float* lum, size_t n)
+    {
+        const CIELanes c(cie);
+
+        if (cie.mLinear)    // no need for gamma
+        {
+            ForEachBlock(dx, dy, dz, lum, n,
+                [&](VFloat, VFloat, VFloat vz, VFloat& oL)
+                {
+                    oL = c.Luminance(vz, 0.0f, 0.0f);
+                }
+            );
+
+            return;
+        }
+
+        const VFloat sx(cie.mToSun.x), sy(cie.mToSun.y), sz(cie.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, lum, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat& oL)
+            {
+                VFloat cosGamma = sx * vx + sy * vy + sz * vz;
+
+                oL = c.Luminance(vz, cosGamma, Acos(cosGamma));
+            }
+        );
+    }
+}
+
+//------------------------------------------------------------------------------
+// SkyPreetham
+//------------------------------------------------------------------------------
+
+namespace
+{
+    struct PerezCoeffLanes  // Perez coefficients for one channel, broadcast across lanes
+    {
+        PerezCoeffLanes(const float lambdas[5], float invDen) :
+            A(lambdas[0]),
+            B(lambdas[1]),
+            C(lambdas[2]),
+            D(lambdas[3]),
+            E(lambdas[4]),
+            S(invDen)
+        {}
+
+        VFloat A, B, C, D, E;
+        VFloat S;       // normalisation/zenith scale, mPerezInvDen
+    };
+
+    struct PerezDirLanes    // per-direction terms shared by all channels
+    {
+        PerezDirLanes(VFloat cosTheta, VFloat cosGamma, VFloat gamma) :
+            gamma    (gamma),
+            cosGamma2(cosGamma * cosGamma),
+            invCosEps(1.0f / (cosTheta + 1e-6f))
+        {}
+
+        VFloat gamma;
+        VFloat cosGamma2;
+        VFloat invCosEps;
+    };
+
+    inline VFloat PerezUpper(const PerezCoeffLanes& c, const PerezDirLanes& d)
+    {
+        return (1.0f + c.A * Exp(c.B * d.invCosEps))
+             * (1.0f + c.C * Exp(c.D * d.gamma) + c.E * d.cosGamma2)
+             * c.S;
+    }
+
+    struct xyYToRGBLanes    // xyY -> XYZ -> RGB folded into one step
+    {
+        // With XYZ = (x, y, 1 - x - y) Y / y, each RGB channel is
+        //   (Y / y) (m0 x + m1 y + m2 (1 - x - y)) = (Y / y) ((m0 - m2) x + (m1 - m2) y + m2)
+        xyYToRGBLanes() :
+            rx(kXYZToRGB[0][0] - kXYZToRGB[0][2]), ry(kXYZToRGB[0][1] - kXYZToRGB[0][2]), r1(kXYZToRGB[0][2]),
+            gx(kXYZToRGB[1][0] - kXYZToRGB[1][2]), gy(kXYZToRGB[1][1] - kXYZToRGB[1][2]), g1(kXYZToRGB[1][2]),
+            bx(kXYZToRGB[2][0] - kXYZToRGB[2][2]), by(kXYZToRGB[2][1] - kXYZToRGB[2][2]), b1(kXYZToRGB[2][2])
+        {}
+
+        void Apply(VFloat x, VFloat y, VFloat Y, VFloat& r, VFloat& g, VFloat& b) const
+        {
+            VFloat k = Y / y;
+
+            r = k * MulAdd(rx, x, MulAdd(ry, y, r1));
+            g = k * MulAdd(gx, x, MulAdd(gy, y, g1));
+            b = k * MulAdd(bx, x, MulAdd(by, y, b1));
+        }
+
+        VFloat rx, ry, r1;
+        VFloat gx, gy, g1;
+        VFloat bx, by, b1;
+    };
+
+    struct PreethamLanes    // SkyPreetham parameters, broadcast across lanes
+    {
+        PreethamLanes(const SkyPreetham& pt) :
+            cx(pt.mPerez_x, pt.mPerezInvDen.x),
+            cy(pt.mPerez_y, pt.mPerezInvDen.y),
+            cY(pt.mPerez_Y, pt.mPerezInvDen.z)
+        {}
+
+        void RGB(const PerezDirLanes& d, VFloat& r, VFloat& g, VFloat& b) const
+        {
+            toRGB.Apply(PerezUpper(cx, d), PerezUpper(cy, d), PerezUpper(cY, d), r, g, b);
+        }
+
+        VFloat Luminance(const PerezDirLanes& d) const
+        {
+            return PerezUpper(cY, d);
+        }
+
+        PerezCoeffLanes cx, cy, cY;
+        xyYToRGBLanes   toRGB;
+    };
+
+    void PreethamRGB(const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n)
+    {
+        const PreethamLanes c(pt);
+
+        const VFloat sx(pt.mToSun.x), sy(pt.mToSun.y), sz(pt.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, r, g, b, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat& oR, VFloat& oG, VFloat& oB)
+            {
+                VFloat cosGamma = sx * vx + sy * vy + sz * vz;
+
+                c.RGB(PerezDirLanes(Max(vz, 0.0f), cosGamma, Acos(cosGamma)), oR, oG, oB);
+            }
+        );
+    }
+
+    void PreethamLuminance(const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, float* lum, size_t n)
+    {
+        const PreethamLanes c(pt);
+
+        const VFloat sx(pt.mToSun.x), sy(pt.mToSun.y), sz(pt.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, lum, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat& oY)
+            {
+                VFloat cosGamma = sx * vx + sy * vy + sz * vz;
+
+                oY = c.Luminance(PerezDirLanes(Max(vz, 0.0f), cosGamma, Acos(cosGamma)));
+            }
+        );
+    }
+}
+
+//------------------------------------------------------------------------------
+// SkyHosek
+//------------------------------------------------------------------------------
+
+namespace
+{
+    struct HosekCoeffLanes  // Hosek coefficients for one channel, broadcast across lanes
+    {
+        HosekCoeffLanes(const float coeffs[9], float rad) :
+            A (coeffs[0]),
+            B (coeffs[1]),
+            C (coeffs[3]),
+            D (coeffs[4]),
+            E (coeffs[5]),
+            F (coeffs[6]),
+            H (coeffs[7]),
+            I1(coeffs[2] - 1.0f),
+            G1(1.0f + coeffs[8] * coeffs[8]),
+            G2(-2.0f * coeffs[8]),
+            R (rad)
+        {}
+
+        VFloat A, B, C, D, E, F, H;
+        VFloat I1;      // I - 1
+        VFloat G1, G2;  // mie denominator is G1 + G2 cos(gamma)
+        VFloat R;       // overall radiance
+    };
+
+    struct HosekDirLanes    // per-direction terms shared by all channels
+    {
+        HosekDirLanes(VFloat cosTheta, VFloat cosGamma, VFloat gamma, VFloat zenith) :
+            cosGamma (cosGamma),
+            gamma    (gamma),
+            rayM     (cosGamma * cosGamma),
+            zenith   (zenith),
+            invCosEps(1.0f / (cosTheta + 0.01f))
+        {}
+
+        VFloat cosGamma;
+        VFloat gamma;
+        VFloat rayM;
+        VFloat zenith;
+        VFloat invCosEps;
+    };
+
+    inline VFloat EvalHosekCoeffs(const HosekCoeffLanes& c, const HosekDirLanes& d)
+    {
+        VFloat expM  = Exp(c.D * d.gamma);
+        VFloat mieD  = c.G1 + c.G2 * d.cosGamma;
+        VFloat mieR  = RSqrt(mieD);
+        VFloat mieM  = (1.0f + d.rayM) * mieR * mieR * mieR;
+
+        return (1.0f + c.A * Exp(c.B * d.invCosEps))
+             * (1.0f + c.C * expM + c.E * d.rayM + c.F * mieM + c.H * d.zenith + c.I1)
+             * c.R;
+    }
+
+    struct HosekLanes   // SkyHosek parameters, broadcast across lanes
+    {
+        HosekLanes(const SkyHosek& hk) :
+            cX(hk.mCoeffsXYZ[0], hk.mRadXYZ.x),
+            cY(hk.mCoeffsXYZ[1], hk.mRadXYZ.y),
+            cZ(hk.mCoeffsXYZ[2], hk.mRadXYZ.z),
+            xyzToRGB(kXYZToRGB)
+        {}
+
+        void XYZ(const HosekDirLanes& d, VFloat& X, VFloat& Y, VFloat& Z) const
+        {
+            X = EvalHosekCoeffs(cX, d);
+            Y = EvalHosekCoeffs(cY, d);
+            Z = EvalHosekCoeffs(cZ, d);
+        }
+
+        void RGB(const HosekDirLanes& d, VFloat& r, VFloat& g, VFloat& b) const
+        {
+            XYZ(d, r, g, b);
+            xyzToRGB.Apply(r, g, b);
+        }
+
+        VFloat Luminance(const HosekDirLanes& d) const
+        {
+            return EvalHosekCoeffs(cY, d);
+        }
+
+        HosekCoeffLanes cX, cY, cZ;
+        Mat3Lanes       xyzToRGB;
+    };
+
+    inline HosekDirLanes HosekDir(VFloat sx, VFloat sy, VFloat sz, VFloat vx, VFloat vy, VFloat vz)
+    {
+        VFloat cosTheta = Max(vz, 0.0f);
+        VFloat cosGamma = sx * vx + sy * vy + sz * vz;
+
+        return HosekDirLanes(cosTheta, cosGamma, Acos(cosGamma), Sqrt(cosTheta));
+    }
+
+    void HosekXYZ(const SkyHosek& hk, const float* dx, const float* dy, const float* dz, float* X, float* Y, float* Z, size_t n)
+    {
+        const HosekLanes c(hk);
+
+        const VFloat sx(hk.mToSun.x), sy(hk.mToSun.y), sz(hk.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, X, Y, Z, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat& oX, VFloat& oY, VFloat& oZ)
+            {
+                c.XYZ(HosekDir(sx, sy, sz, vx, vy, vz), oX, oY, oZ);
+            }
+        );
+    }
+
+    void HosekLuminance(const SkyHosek& hk, const float* dx, const float* dy, const float* dz, float* lum, size_t n)
+    {
+        const HosekCoeffLanes cY(hk.mCoeffsXYZ[1], hk.mRadXYZ.y);
+
+        const VFloat sx(hk.mToSun.x), sy(hk.mToSun.y), sz(hk.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, lum, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat& oL)
+            {
+                oL = EvalHosekCoeffs(cY, HosekDir(sx, sy, sz, vx, vy, vz));
+            }
+        );
+    }
+
+    void HosekRGB(const SkyHosek& hk, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n)
+    {
+        const HosekLanes c(hk);
+
+        const VFloat sx(hk.mToSun.x), sy(hk.mToSun.y), sz(hk.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, r, g, b, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat& oR, VFloat& oG, VFloat& oB)
+            {
+                c.RGB(HosekDir(sx, sy, sz, vx, vy, vz), oR, oG, oB);
+            }
+        );
+    }
+}
+
+//------------------------------------------------------------------------------
+// SkyTable
+//------------------------------------------------------------------------------
+
+namespace
+{
+    struct LerpLanes    // lane-wise equivalent of LerpSample's index and fraction
+    {
+        LerpLanes(VFloat s, int n)
+        {
+            s = Min(Max(s, 0.0f), 1.0f - 1e-6f) * float(n - 1);
+
+            i0 = TruncToInt(s);     // s >= 0, so trunc = floor
+            sf = s - ToFloat(i0);
+        }
+
+        VFloat Sample(const float* c) const
+        {
+            return Gather(c, i0) * (1.0f - sf) + Gather(c + 1, i0) * sf;
+        }
+
+        VInt   i0;
+        VFloat sf;
+    };
+
+    inline VFloat MapThetaLanes(VFloat cosTheta)  // cosTheta >= 0
+    {
+    #ifdef REMAP_THETA
+        return Sqrt(cosTheta);
+    #else
+        return cosTheta;
+    #endif
+    }
+
+    inline VFloat MapGammaLanes(VFloat cosGamma)
+    {
+        return Sqrt(Max(0.5f * (1.0f - cosGamma), 0.0f));
+    }
+
+    struct TablePreethamLanes   // SkyTable + SkyPreetham parameters, broadcast across lanes
+    {
+        TablePreethamLanes(const SkyTable& table, const SkyPreetham& pt) :
+            table(table),
+            invDenX(pt.mPerezInvDen.x), invDenY(pt.mPerezInvDen.y), invDenZ(pt.mPerezInvDen.z),
+            maxTheta(table.mMaxTheta), maxGamma(table.mMaxGamma)
+        {}
+
+        void RGB(VFloat cosTheta, VFloat cosGamma, VFloat& r, VFloat& g, VFloat& b) const
+        {
+            LerpLanes lt(MapThetaLanes(cosTheta), SkyTable::kTableSize);
+            LerpLanes lg(MapGammaLanes(cosGamma), SkyTable::kTableSize);
+
+            VFloat Fx = lt.Sample(table.mThetaTableSoA[0]);
+            VFloat Fy = lt.Sample(table.mThetaTableSoA[1]);
+            VFloat FY = lt.Sample(table.mThetaTableSoA[2]);
+            VFloat Gx = lg.Sample(table.mGammaTableSoA[0]);
+            VFloat Gy = lg.Sample(table.mGammaTableSoA[1]);
+            VFloat GY = lg.Sample(table.mGammaTableSoA[2]);
+
+        #ifdef SIM_CLAMP
+            FY *= maxTheta;
+            GY *= maxGamma;
+        #endif
+
+            VFloat x = (1.0f - Fx) * (1.0f + Gx) * invDenX;
+            VFloat y = (1.0f - Fy) * (1.0f + Gy) * invDenY;
+            VFloat Y = (1.0f - FY) * (1.0f + GY) * invDenZ;
+
+            toRGB.Apply(x, y, Y, r, g, b);
+        }
+
+        const SkyTable& table;
+        VFloat          invDenX, invDenY, invDenZ;
+        VFloat          maxTheta, maxGamma;     // SIM_CLAMP only
+        xyYToRGBLanes   toRGB;
+    };
+
+    struct TableHosekLanes  // SkyTable + SkyHosek parameters, broadcast across lanes
+    {
+        TableHosekLanes(const SkyTable& table, const SkyHosek& hk) :
+            table(table),
+            radX(hk.mRadXYZ.x), radY(hk.mRadXYZ.y), radZ(hk.mRadXYZ.z),
+            hX(hk.mCoeffsXYZ[0][7]), hY(hk.mCoeffsXYZ[1][7]), hZ(hk.mCoeffsXYZ[2][7]),
+            iX(hk.mCoeffsXYZ[0][2]), iY(hk.mCoeffsXYZ[1][2]), iZ(hk.mCoeffsXYZ[2][2]),
+            maxTheta(table.mMaxTheta), maxGamma(table.mMaxGamma),
+            xyzToRGB(kXYZToRGB)
+        {}
+
+        void RGB(VFloat cosTheta, VFloat cosGamma, VFloat zenith, VFloat& r, VFloat& g, VFloat& b) const
+        {
+            LerpLanes lt(MapThetaLanes(cosTheta), SkyTable::kTableSize);
+            LerpLanes lg(MapGammaLanes(cosGamma), SkyTable::kTableSize);
+
+            VFloat FX = lt.Sample(table.mThetaTableSoA[0]);
+            VFloat FY = lt.Sample(table.mThetaTableSoA[1]);
+            VFloat FZ = lt.Sample(table.mThetaTableSoA[2]);
+            VFloat GX = lg.Sample(table.mGammaTableSoA[0]);
+            VFloat GY = lg.Sample(table.mGammaTableSoA[1]);
+            VFloat GZ = lg.Sample(table.mGammaTableSoA[2]);
+
+        #ifdef SIM_CLAMP
+            FX *= maxTheta; FY *= maxTheta; FZ *= maxTheta;
+            GX *= maxGamma; GY *= maxGamma; GZ *= maxGamma;
+        #endif
+
+            // (1 - F(theta)) * (1 + G(phi) + H(theta))
+            r = (1.0f - FX) * (GX + hX * zenith + iX) * radX;
+            g = (1.0f - FY) * (GY + hY * zenith + iY) * radY;
+            b = (1.0f - FZ) * (GZ + hZ * zenith + iZ) * radZ;
+
+            xyzToRGB.Apply(r, g, b);
+        }
+
+        const SkyTable& table;
+        VFloat          radX, radY, radZ;
+        VFloat          hX, hY, hZ;
+        VFloat          iX, iY, iZ;
+        VFloat          maxTheta, maxGamma;     // SIM_CLAMP only
+        Mat3Lanes       xyzToRGB;
+    };
+
+    void TablePreethamRGB(const SkyTable& table, const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n)
+    {
+        const TablePreethamLanes c(table, pt);
+
+        const VFloat sx(pt.mToSun.x), sy(pt.mToSun.y), sz(pt.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, r, g, b, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat& oR, VFloat& oG, VFloat& oB)
+            {
+                c.RGB(Max(vz, 0.0f), sx * vx + sy * vy + sz * vz, oR, oG, oB);
+            }
+        );
+    }
+
+    void TableHosekRGB(const SkyTable& table, const SkyHosek& hk, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b, size_t n)
+    {
+        const TableHosekLanes c(table, hk);
+
+        const VFloat sx(hk.mToSun.x), sy(hk.mToSun.y), sz(hk.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, r, g, b, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat& oR, VFloat& oG, VFloat& oB)
+            {
+                VFloat cosTheta = Max(vz, 0.0f);
+
+                c.RGB(cosTheta, sx * vx + sy * vy + sz * vz, Sqrt(cosTheta), oR, oG, oB);
+            }
+        );
+    }
+}
+
+//------------------------------------------------------------------------------
+// SkyBRDF
+//------------------------------------------------------------------------------
+
+namespace
+{
+    struct BiLerpLanes  // lane-wise equivalent of BiLerpSample's indices and fractions
+    {
+        BiLerpLanes(VFloat s, VFloat t, int w, int h) :
+            w(w)
+        {
+            s = Min(Max(s, 0.0f), 1.0f - 1e-6f) * float(w - 1);
+            t = Min(Max(t, 0.0f), 1.0f - 1e-6f) * float(h - 1);
+
+            VFloat s0 = ToFloat(TruncToInt(s));     // s, t >= 0, so trunc = floor
+            VFloat t0 = ToFloat(TruncToInt(t));
+
+            sf = s - s0;
+            tf = t - t0;
+
+            i00 = TruncToInt(MulAdd(t0, float(w), s0));  // exact for table-sized indices
+        }
+
+        VFloat Sample(const float* c) const
+        {
+            VFloat c00 = Gather(c        , i00);
+            VFloat c10 = Gather(c     + 1, i00);
+            VFloat c01 = Gather(c + w    , i00);
+            VFloat c11 = Gather(c + w + 1, i00);
+
+            return c00 * (1.0f - sf) * (1.0f - tf)
+                 + c10 *         sf  * (1.0f - tf)
+                 + c01 * (1.0f - sf) *         tf
+                 + c11 *         sf  *         tf;
+        }
+
+        int    w;
+        VInt   i00;
+        VFloat sf;
+        VFloat tf;
+    };
+
+    inline VFloat MapThetaSignedLanes(VFloat cosTheta)
+    {
+    #ifdef REMAP_THETA
+        VFloat t = Sqrt(Abs(cosTheta));
+        return Select(cosTheta < 0.0f, -t, t);
+    #else
+        return cosTheta;
+    #endif
+    }
+
+    struct BRDFPreethamLanes    // SkyBRDF + SkyPreetham parameters, broadcast across lanes
+    {
+        BRDFPreethamLanes(const SkyBRDF& brdf, const SkyPreetham& pt) :
+            brdf(brdf),
+            invDenX(pt.mPerezInvDen.x), invDenY(pt.mPerezInvDen.y), invDenZ(pt.mPerezInvDen.z),
+            maxTheta(brdf.mMaxTheta), maxGamma(brdf.mMaxGamma)
+        {
+            VL_ASSERT(!brdf.mXYZ);
+        }
+
+        void RGB(VFloat vz, VFloat cosGamma, VFloat roughness, VFloat& r, VFloat& g, VFloat& b) const
+        {
+            BiLerpLanes lt(0.5f * (MapThetaSignedLanes(vz) + 1.0f), roughness, SkyBRDF::kTableSize, SkyBRDF::kBRDFSamples);
+            BiLerpLanes lg(MapGammaLanes(cosGamma),                   roughness, SkyBRDF::kTableSize, SkyBRDF::kBRDFSamples);
+
+            VFloat Fx = lt.Sample(brdf.mBRDFThetaTableSoA[0]);
+            VFloat Fy = lt.Sample(brdf.mBRDFThetaTableSoA[1]);
+            VFloat FY = lt.Sample(brdf.mBRDFThetaTableSoA[2]);
+            VFloat Gx = lg.Sample(brdf.mBRDFGammaTableSoA[0]);
+            VFloat Gy = lg.Sample(brdf.mBRDFGammaTableSoA[1]);
+            VFloat GY = lg.Sample(brdf.mBRDFGammaTableSoA[2]);
+
+        #ifdef SIM_CLAMP
+            FY *= maxTheta;
+            GY *= maxGamma;
+        #endif
+
+            // (1 - F(theta)) * (1 + G(phi))
+            VFloat x = (1.0f - Fx) * (1.0f + Gx) * invDenX;
+            VFloat y = (1.0f - Fy) * (1.0f + Gy) * invDenY;
+            VFloat Y = (1.0f - FY) * (1.0f + GY) * invDenZ;
+
+            toRGB.Apply(x, y, Y, r, g, b);
+        }
+
+        const SkyBRDF&  brdf;
+        VFloat          invDenX, invDenY, invDenZ;
+        VFloat          maxTheta, maxGamma;     // SIM_CLAMP only
+        xyYToRGBLanes   toRGB;
+    };
+
+    struct BRDFHosekLanes   // SkyBRDF + SkyHosek parameters, broadcast across lanes
+    {
+        BRDFHosekLanes(const SkyBRDF& brdf, const SkyHosek& hk) :
+            brdf(brdf),
+            radX(hk.mRadXYZ.x), radY(hk.mRadXYZ.y), radZ(hk.mRadXYZ.z),
+            hX(hk.mCoeffsXYZ[0][7]), hY(hk.mCoeffsXYZ[1][7]), hZ(hk.mCoeffsXYZ[2][7]),
+            iX(hk.mCoeffsXYZ[0][2] - 1.0f), iY(hk.mCoeffsXYZ[1][2] - 1.0f), iZ(hk.mCoeffsXYZ[2][2] - 1.0f),
+            maxTheta(brdf.mMaxTheta), maxGamma(brdf.mMaxGamma),
+            xyzToRGB(kXYZToRGB)
+        {
+            VL_ASSERT(brdf.mXYZ);
+        }
+
+        void RGB(VFloat vz, VFloat cosGamma, VFloat roughness, VFloat& r, VFloat& g, VFloat& b) const
+        {
+            cosGamma = Min(Max(cosGamma, 0.0f), 1.0f);
+
+            BiLerpLanes lt(0.5f * (MapThetaSignedLanes(vz) + 1.0f), roughness, SkyBRDF::kTableSize, SkyBRDF::kBRDFSamples);
+            BiLerpLanes lg(MapGammaLanes(cosGamma),                   roughness, SkyBRDF::kTableSize, SkyBRDF::kBRDFSamples);
+
+            VFloat FX = lt.Sample(brdf.mBRDFThetaTableSoA[0]);
+            VFloat FY = lt.Sample(brdf.mBRDFThetaTableSoA[1]);
+            VFloat FZ = lt.Sample(brdf.mBRDFThetaTableSoA[2]);
+            VFloat GX = lg.Sample(brdf.mBRDFGammaTableSoA[0]);
+            VFloat GY = lg.Sample(brdf.mBRDFGammaTableSoA[1]);
+            VFloat GZ = lg.Sample(brdf.mBRDFGammaTableSoA[2]);
+
+            VFloat H   = lt.Sample(brdf.mBRDFThetaTableH[0]);
+            VFloat FHX = lt.Sample(brdf.mBRDFThetaTableFHSoA[0]);
+            VFloat FHY = lt.Sample(brdf.mBRDFThetaTableFHSoA[1]);
+            VFloat FHZ = lt.Sample(brdf.mBRDFThetaTableFHSoA[2]);
+
+        #ifdef SIM_CLAMP
+            FX *= maxTheta; FY *= maxTheta; FZ *= maxTheta;
+            GX *= maxGamma; GY *= maxGamma; GZ *= maxGamma;
+            FHX *= maxTheta; FHY *= maxTheta; FHZ *= maxTheta;
+        #endif
+
+            // (1 - F(theta)) * (1 + G(phi) + H(theta)), with the FH term from its own table
+            //   = (1 - F)(1 + G) + H - FH
+            r = Max((1.0f - FX) * (1.0f + GX) + (H * hX + iX) - (FHX * hX + FX * iX), 0.0f) * radX;
+            g = Max((1.0f - FY) * (1.0f + GY) + (H * hY + iY) - (FHY * hY + FY * iY), 0.0f) * radY;
+            b = Max((1.0f - FZ) * (1.0f + GZ) + (H * hZ + iZ) - (FHZ * hZ + FZ * iZ), 0.0f) * radZ;
+
+            xyzToRGB.Apply(r, g, b);
+        }
+
+        const SkyBRDF&  brdf;
+        VFloat          radX, radY, radZ;
+        VFloat          hX, hY, hZ;
+        VFloat          iX, iY, iZ;
+        VFloat          maxTheta, maxGamma;     // SIM_CLAMP only
+        Mat3Lanes       xyzToRGB;
+    };
+
+    void BRDFPreethamRGB(const SkyBRDF& brdf, const SkyPreetham& pt, const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n)
+    {
+        const BRDFPreethamLanes c(brdf, pt);
+
+        const VFloat sx(pt.mToSun.x), sy(pt.mToSun.y), sz(pt.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, roughness, r, g, b, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat vr, VFloat& oR, VFloat& oG, VFloat& oB)
+            {
+                c.RGB(vz, sx * vx + sy * vy + sz * vz, vr, oR, oG, oB);
+            }
+        );
+    }
+
+    void BRDFHosekRGB(const SkyBRDF& brdf, const SkyHosek& hk, const float* dx, const float* dy, const float* dz, const float* roughness, float* r, float* g, float* b, size_t n)
+    {
+        const BRDFHosekLanes c(brdf, hk);
+
+        const VFloat sx(hk.mToSun.x), sy(hk.mToSun.y), sz(hk.mToSun.z);
+
+        ForEachBlock(dx, dy, dz, roughness, r, g, b, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat vr, VFloat& oR, VFloat& oG, VFloat& oB)
+            {
+                c.RGB(vz, sx * vx + sy * vy + sz * vz, vr, oR, oG, oB);
+            }
+        );
+    }
+}
+
+//------------------------------------------------------------------------------
+// Fused evaluation of several models over the same directions
+//------------------------------------------------------------------------------
+
+namespace
+{
+    void DirectionTerms(const Vec3f& toSun, const float* dx, const float* dy, const float* dz, float* cosGamma, float* gamma, float* zenith, size_t n)
+    {
+        const VFloat sx(toSun.x), sy(toSun.y), sz(toSun.z);
+
+        ForEachBlock(dx, dy, dz, cosGamma, gamma, zenith, n,
+            [&](VFloat vx, VFloat vy, VFloat vz, VFloat& oCosGamma, VFloat& oGamma, VFloat& oZenith)
+            {
+                oCosGamma = sx * vx + sy * vy + sz * vz;
+                oGamma    = Acos(oCosGamma);
+                oZenith   = Sqrt(Max(vz, 0.0f));
+            }
+        );
+    }
+
+    // Each model takes a pass over the prepared terms in turn. With a chunk's
+    // worth of directions these all stay in L1, so this is much cheaper than
+    // recomputing them, gamma in particular.
+    void FusedRGB(const BatchModel* models, int numModels, const BatchDirections& dirs, size_t n)
+    {
+        for (int i = 0; i < numModels; i++)
+        {
+            const BatchModel& m = models[i];
+
+            switch (m.mType)
+            {
+            case kBatchPreetham:
+                {
+                    const PreethamLanes c(*m.mPreetham);
+
+                    ForEachBlock(dirs.mZ, dirs.mCosGamma, dirs.mGamma, dirs.mZenith, m.mR, m.mG, m.mB, n,
+                        [&](VFloat vz, VFloat cosGamma, VFloat gamma, VFloat, VFloat& oR, VFloat& oG, VFloat& oB)
+                        {
+                            c.RGB(PerezDirLanes(Max(vz, 0.0f), cosGamma, gamma), oR, oG, oB);
+                        }
+                    );
+                }
+                break;
+
+            case kBatchPreethamTable:
+                {
+                    const TablePreethamLanes c(*m.mTable, *m.mPreetham);
+
+                    ForEachBlock(dirs.mZ, dirs.mCosGamma, dirs.mGamma, dirs.mZenith, m.mR, m.mG, m.mB, n,
+                        [&](VFloat vz, VFloat cosGamma, VFloat, VFloat, VFloat& oR, VFloat& oG, VFloat& oB)
+                        {
+                            c.RGB(Max(vz, 0.0f), cosGamma, oR, oG, oB);
+                        }
+                    );
+                }
+                break;
+
+            case kBatchPreethamBRDF:
+                {
+                    const BRDFPreethamLanes c(*m.mBRDF, *m.mPreetham);
+                    const VFloat roughness(m.mRoughness);
+
+                    ForEachBlock(dirs.mZ, dirs.mCosGamma, dirs.mGamma, dirs.mZenith, m.mR, m.mG, m.mB, n,
+                        [&](VFloat vz, VFloat cosGamma, VFloat, VFloat, VFloat& oR, VFloat& oG, VFloat& oB)
+                        {
+                            c.RGB(vz, cosGamma, roughness, oR, oG, oB);
+                        }
+                    );
+                }
+                break;
+
+            case kBatchHosek:
+                {
+                    const HosekLanes c(*m.mHosek);
+
+                    ForEachBlock(dirs.mZ, dirs.mCosGamma, dirs.mGamma, dirs.mZenith, m.mR, m.mG, m.mB, n,
+                        [&](VFloat vz, VFloat cosGamma, VFloat gamma, VFloat zenith, VFloat& oR, VFloat& oG, VFloat& oB)
+                        {
+                            c.RGB(HosekDirLanes(Max(vz, 0.0f), cosGamma, gamma, zenith), oR, oG, oB);
+                        }
+                    );
+                }
+                break;
+
+            case kBatchHosekTable:
+                {
+                    const TableHosekLanes c(*m.mTable, *m.mHosek);
+
+                    ForEachBlock(dirs.mZ, dirs.mCosGamma, dirs.mGamma, dirs.mZenith, m.mR, m.mG, m.mB, n,
+                        [&](VFloat vz, VFloat cosGamma, VFloat, VFloat zenith, VFloat& oR, VFloat& oG, VFloat& oB)
+                        {
+                            c.RGB(Max(vz, 0.0f), cosGamma, zenith, oR, oG, oB);
+                        }
+                    );
+                }
+                break;
+
+            case kBatchHosekBRDF:
+                {
+                    const BRDFHosekLanes c(*m.mBRDF, *m.mHosek);
+                    const VFloat roughness(m.mRoughness);
+
+                    ForEachBlock(dirs.mZ, dirs.mCosGamma, dirs.mGamma, dirs.mZenith, m.mR, m.mG, m.mB, n,
+                        [&](VFloat vz, VFloat cosGamma, VFloat, VFloat, VFloat& oR, VFloat& oG, VFloat& oB)
+                        {
+                            c.RGB(vz, cosGamma, roughness, oR, oG, oB);
+                        }
+                    );
+                }
+                break;
+
+            case kBatchCIE:
+                {
+                    const CIELanes c(*m.mCIE);
+
+                    ForEachBlock(dirs.mZ, dirs.mCosGamma, dirs.mGamma, dirs.mZenith, m.mR, m.mG, m.mB, n,
+                        [&](VFloat vz, VFloat cosGamma, VFloat gamma, VFloat, VFloat& oR, VFloat& oG, VFloat& oB)
+                        {
+                            oR = oG = oB = c.Luminance(vz, cosGamma, gamma);
+                        }
+                    );
+                }
+                break;
+
+            default:
+                for (size_t j = 0; j < n; j++)
+                    m.mR[j] = m.mG[j] = m.mB[j] = 0.0f;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Kernel table
+//------------------------------------------------------------------------------
+
+namespace
+{
+    const BatchKernels kKernels =
+    {
+        SS_SIMD_NAME,
+
+        CIELuminance,
+        PreethamRGB,
+        PreethamLuminance,
+        HosekXYZ,
+        HosekRGB,
+        HosekLuminance,
+
+        TablePreethamRGB,
+        TableHosekRGB,
+
+        BRDFPreethamRGB,
+        BRDFHosekRGB,
+
+        DirectionTerms,
+        FusedRGB
+    };
+}
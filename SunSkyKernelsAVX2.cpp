@@ -0,0 +1,22 @@
+//
+// SunSkyKernelsAVX2.cpp
+//
+// AVX2 + FMA build of the batch kernels. Must be compiled with -mavx2 -mfma to be
+// used -- see SunSkyKernels.h.
+//
+
+#if defined(__AVX2__) && defined(__FMA__)
+    #include "SunSkyKernels.inl"
+
+    const BatchKernels* SSLib::BatchKernelsAVX2()
+    {
+        return &kKernels;
+    }
+#else
+    #include "SunSkyKernels.h"
+
+    const SSLib::BatchKernels* SSLib::BatchKernelsAVX2()
+    {
+        return 0;
+    }
+#endif
@@ -0,0 +1,22 @@
+//
+// SunSkyKernelsAVX512.cpp
+//
+// AVX-512 build of the batch kernels. Must be compiled with -mavx512f to be
+// used -- see SunSkyKernels.h.
+//
+
+#if defined(__AVX512F__)
+    #include "SunSkyKernels.inl"
+
+    const BatchKernels* SSLib::BatchKernelsAVX512()
+    {
+        return &kKernels;
+    }
+#else
+    #include "SunSkyKernels.h"
+
+    const SSLib::BatchKernels* SSLib::BatchKernelsAVX512()
+    {
+        return 0;
+    }
+#endif
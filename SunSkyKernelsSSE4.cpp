@@ -0,0 +1,22 @@
+//
+// SunSkyKernelsSSE4.cpp
+//
+// SSE4 build of the batch kernels. Must be compiled with -msse4.2 to be
+// used -- see SunSkyKernels.h.
+//
+
+#if defined(__SSE4_2__)
+    #include "SunSkyKernels.inl"
+
+    const BatchKernels* SSLib::BatchKernelsSSE4()
+    {
+        return &kKernels;
+    }
+#else
+    #include "SunSkyKernels.h"
+
+    const SSLib::BatchKernels* SSLib::BatchKernelsSSE4()
+    {
+        return 0;
+    }
+#endif
@@ -0,0 +1,14 @@
+//
+// SunSkyKernelsScalar.cpp
+//
+// Single-lane build of the batch kernels, for reference and testing.
+// See SunSkyKernels.h.
+//
+
+#define SS_SIMD_FORCE_SCALAR
+#include "SunSkyKernels.inl"
+
+const BatchKernels* SSLib::BatchKernelsScalar()
+{
+    return &kKernels;
+}
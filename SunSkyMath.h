@@ -0,0 +1,168 @@
+//
+//  SunSkyMath.h
+//
+//  Scalar and SIMD versions of the transcendentals used by the sky models:
+//  exp, acos, pow(x, 1.5) and 1/sqrt. Internal to SunSky.cpp and SunSkyTool.cpp
+//  -- not part of the public API.
+//
+//  By default these are range-reduced polynomial approximations. Define
+//  SS_EXACT_MATH to route everything through libm instead, e.g., for
+//  reference comparisons. The Fast variants are always available.
+//
+//  Max errors, measured against double precision, scalar and SIMD alike:
+//
+//    ExpFast       2 ulp over [-87, 88]
+//    AcosFast      2 ulp over [-1, 1]
+//    Pow1_5Fast    2 ulp
+//    RSqrtFast     5 ulp over positive normals (one Newton step from the 12-bit
+//                  hardware estimate)
+//
+
+#ifndef SUN_SKY_MATH_H
+#define SUN_SKY_MATH_H
+
+#include "SunSkySIMD.h"
+
+#include <math.h>
+
+namespace SSLib
+{
+    namespace Math
+    {
+    inline namespace SS_SIMD_NS     // see SunSkySIMD.h
+    {
+        using SIMD::VFloat;
+        using SIMD::VMask;
+        using SIMD::VInt;
+
+        //----------------------------------------------------------------------
+        // SIMD
+        //----------------------------------------------------------------------
+
+        // Range-reduced exp, Cephes-style polynomial. Larger inputs are
+        // clamped, and smaller ones return 0, as with expf, which also avoids
+        // denormal stalls in subsequent maths.
+        inline VFloat ExpFast(VFloat x)
+        {
+            using namespace SIMD;
+
+            VMask under = x < -87.0f;
+            x = Min(Max(x, -87.0f), 88.0f);
+
+            VInt   n  = RoundToInt(x * 1.44269504088896341f);
+            VFloat fn = ToFloat(n);
+
+            // r = x - n ln(2), with ln(2) split for extra precision
+            VFloat r = x - fn * 0.693359375f;
+            r = r + fn * 2.12194440e-4f;
+
+            VFloat p =      1.9875691500e-4f;
+            p = MulAdd(p, r, 1.3981999507e-3f);
+            p = MulAdd(p, r, 8.3334519073e-3f);
+            p = MulAdd(p, r, 4.1665795894e-2f);
+            p = MulAdd(p, r, 1.6666665459e-1f);
+            p = MulAdd(p, r, 5.0000001201e-1f);
+            p = MulAdd(p, r * r, r + 1.0f);
+
+            return Select(under, 0.0f, p * Pow2(n));
+        }
+
+        // Cephes-style acos, via asin on [0, 0.5] and the half-angle identity
+        // above that. Input is clamped to [-1, 1].
+        inline VFloat AcosFast(VFloat x)
+        {
+            using namespace SIMD;
+
+            x = Min(Max(x, -1.0f), 1.0f);
+
+            VFloat a   = Abs(x);
+            VMask  big = a > 0.5f;
+
+            VFloat z = Select(big, 0.5f * (1.0f - a), a * a);
+            VFloat s = Select(big, Sqrt(z), a);
+
+            VFloat p =      4.2163199048e-2f;
+            p = MulAdd(p, z, 2.4181311049e-2f);
+            p = MulAdd(p, z, 4.5470025998e-2f);
+            p = MulAdd(p, z, 7.4953002686e-2f);
+            p = MulAdd(p, z, 1.6666752422e-1f);
+            p = MulAdd(p * z, s, s);            // asin(s)
+
+            VFloat r = Select(big, p + p, 1.57079632679489662f - p);   // acos(|x|)
+
+            return Select(x < 0.0f, 3.14159265358979324f - r, r);
+        }
+
+        inline VFloat Pow1_5Fast(VFloat x)
+        {
+            return x * SIMD::Sqrt(x);
+        }
+
+        // Hardware estimate plus one Newton-Raphson step
+        inline VFloat RSqrtFast(VFloat x)
+        {
+            VFloat y = SIMD::RSqrtEstimate(x);
+            return y * (1.5f - 0.5f * x * y * y);
+        }
+
+
+        //----------------------------------------------------------------------
+        // Scalar. These evaluate the SIMD versions in a single lane rather than
+        // duplicating them: the result is identical, and branch-free, which
+        // matters for acos in particular given arbitrary directions.
+        //----------------------------------------------------------------------
+
+        inline float ExpFast   (float x) { return SIMD::First(ExpFast   (VFloat(x))); }
+        inline float AcosFast  (float x) { return SIMD::First(AcosFast  (VFloat(x))); }
+        inline float Pow1_5Fast(float x) { return SIMD::First(Pow1_5Fast(VFloat(x))); }
+        inline float RSqrtFast (float x) { return SIMD::First(RSqrtFast (VFloat(x))); }
+
+
+        //----------------------------------------------------------------------
+        // Selected versions, for use by the sky models
+        //----------------------------------------------------------------------
+
+    #ifdef SS_EXACT_MATH
+        inline float ExpExact   (float x) { return expf(x); }
+        inline float AcosExact  (float x) { return acosf(x); }
+        inline float Pow1_5Exact(float x) { return powf(x, 1.5f); }
+        inline float RSqrtExact (float x) { return 1.0f / sqrtf(x); }
+
+        template<float F(float)> VFloat PerLane(VFloat x)
+        {
+            float t[VFloat::kWidth];
+            SIMD::Store(t, x);
+
+            for (int i = 0; i < VFloat::kWidth; i++)
+                t[i] = F(t[i]);
+
+            return SIMD::Load(t);
+        }
+
+        inline float  Exp   (float  x) { return ExpExact(x); }
+        inline float  Acos  (float  x) { return AcosExact(x); }
+        inline float  Pow1_5(float  x) { return Pow1_5Exact(x); }
+        inline float  RSqrt (float  x) { return RSqrtExact(x); }
+
+        inline VFloat Exp   (VFloat x) { return PerLane<ExpExact>(x); }
+        inline VFloat Acos  (VFloat x) { return PerLane<AcosExact>(x); }
+        inline VFloat Pow1_5(VFloat x) { return PerLane<Pow1_5Exact>(x); }
+        inline VFloat RSqrt (VFloat x) { return PerLane<RSqrtExact>(x); }
+    #else
+        // For scalar exp, libm's (on glibc at least) is already faster than
+        // ExpFast, as it can use a table rather than the polynomial.
+        inline float  Exp   (float  x) { return expf(x); }
+        inline float  Acos  (float  x) { return AcosFast(x); }
+        inline float  Pow1_5(float  x) { return Pow1_5Fast(x); }
+        inline float  RSqrt (float  x) { return RSqrtFast(x); }
+
+        inline VFloat Exp   (VFloat x) { return ExpFast(x); }
+        inline VFloat Acos  (VFloat x) { return AcosFast(x); }
+        inline VFloat Pow1_5(VFloat x) { return Pow1_5Fast(x); }
+        inline VFloat RSqrt (VFloat x) { return RSqrtFast(x); }
+    #endif
+    }
+    }
+}
+
+#endif
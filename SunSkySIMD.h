@@ -0,0 +1,389 @@
+//
+//  SunSkySIMD.h
+//
+//  Minimal SIMD lane wrappers for the batch sky evaluators. See SunSkyMath.h
+//  for the vector maths built on these. Internal to SunSky.cpp and
+//  SunSkyTool.cpp -- not part of the public API.
+//
+
+#ifndef SUN_SKY_SIMD_H
+#define SUN_SKY_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The lane width is chosen at compile time from the target flags. Each choice
+// lives in its own inline namespace, so that translation units built for
+// different instruction sets (see SunSkyKernels.h) can be linked together.
+// Define SS_SIMD_FORCE_SCALAR to use single-float lanes regardless.
+#if defined(SS_SIMD_FORCE_SCALAR)
+    #include <math.h>
+    #define SS_SIMD_SCALAR
+    #define SS_SIMD_NS   Scalar
+    #define SS_SIMD_NAME "scalar"
+#elif defined(__AVX512F__)
+    #include <immintrin.h>
+    #define SS_SIMD_AVX512
+    #define SS_SIMD_NS   AVX512
+    #define SS_SIMD_NAME "avx512"
+#elif defined(__AVX2__)
+    #include <immintrin.h>
+    #define SS_SIMD_AVX2
+    #define SS_SIMD_NS   AVX2
+    #define SS_SIMD_NAME "avx2"
+#elif defined(__SSE4_1__)
+    #include <smmintrin.h>
+    #define SS_SIMD_SSE2
+    #define SS_SIMD_NS   SSE4
+    #define SS_SIMD_NAME "sse4"
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define SS_SIMD_SSE2
+    #define SS_SIMD_NS   SSE2
+    #define SS_SIMD_NAME "sse2"
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #include <arm_neon.h>
+    #define SS_SIMD_NEON
+    #define SS_SIMD_NS   NEON
+    #define SS_SIMD_NAME "neon"
+#else
+    #include <math.h>
+    #define SS_SIMD_SCALAR
+    #define SS_SIMD_NS   Scalar
+    #define SS_SIMD_NAME "scalar"
+#endif
+
+namespace SSLib
+{
+    namespace SIMD
+    {
+    inline namespace SS_SIMD_NS
+    {
+        //----------------------------------------------------------------------
+        // Lane types. VFloat holds kWidth floats, VMask the result of a lane
+        // comparison, and VInt kWidth int32s, used for exponent manipulation.
+        //----------------------------------------------------------------------
+
+    #if defined(SS_SIMD_AVX512)
+
+        struct VMask { __mmask16 m; };
+        struct VInt  { __m512i   i; };
+
+        struct VFloat
+        {
+            enum { kWidth = 16 };
+
+            VFloat() {}
+            VFloat(__m512 a) : v(a) {}
+            VFloat(float s)  : v(_mm512_set1_ps(s)) {}
+
+            __m512 v;
+        };
+
+        inline VFloat Load (const float* p)      { return _mm512_loadu_ps(p); }
+        inline void   Store(float* p, VFloat a)  { _mm512_storeu_ps(p, a.v); }
+        inline float  First(VFloat a)            { return _mm512_cvtss_f32(a.v); }
+
+        inline VFloat operator+(VFloat a, VFloat b) { return _mm512_add_ps(a.v, b.v); }
+        inline VFloat operator-(VFloat a, VFloat b) { return _mm512_sub_ps(a.v, b.v); }
+        inline VFloat operator*(VFloat a, VFloat b) { return _mm512_mul_ps(a.v, b.v); }
+        inline VFloat operator/(VFloat a, VFloat b) { return _mm512_div_ps(a.v, b.v); }
+        inline VFloat operator-(VFloat a)           { return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32(INT32_MIN))); }   // no float xor without AVX512DQ
+
+        inline VFloat Min (VFloat a, VFloat b) { return _mm512_min_ps(a.v, b.v); }
+        inline VFloat Max (VFloat a, VFloat b) { return _mm512_max_ps(a.v, b.v); }
+        inline VFloat Abs (VFloat a)           { return _mm512_abs_ps(a.v); }
+        inline VFloat Sqrt(VFloat a)           { return _mm512_sqrt_ps(a.v); }
+        inline VFloat RSqrtEstimate(VFloat a)  { return _mm512_rsqrt14_ps(a.v); }   // 14 bits
+
+        inline VFloat MulAdd(VFloat a, VFloat b, VFloat c) { return _mm512_fmadd_ps(a.v, b.v, c.v); }
+
+        inline VMask operator< (VFloat a, VFloat b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+        inline VMask operator> (VFloat a, VFloat b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+
+        inline VFloat Select(VMask m, VFloat a, VFloat b) { return _mm512_mask_blend_ps(m.m, b.v, a.v); }  // m ? a : b
+
+        inline VInt   RoundToInt(VFloat a) { return { _mm512_cvtps_epi32(a.v) }; }
+        inline VInt   TruncToInt(VFloat a) { return { _mm512_cvttps_epi32(a.v) }; }
+        inline VFloat ToFloat   (VInt a)   { return _mm512_cvtepi32_ps(a.i); }
+        inline VFloat Pow2      (VInt n)   { return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(n.i, _mm512_set1_epi32(127)), 23)); }
+
+        inline VFloat Gather(const float* table, VInt i) { return _mm512_i32gather_ps(i.i, table, 4); }   // table[i]
+
+        inline VInt   Load (const int32_t* p)       { return { _mm512_loadu_si512(p) }; }
+        inline void   Store(int32_t* p, VInt a)     { _mm512_storeu_si512(p, a.i); }
+        inline VFloat ByteToFloat(VInt a, int byte) { return _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srl_epi32(a.i, _mm_cvtsi32_si128(8 * byte)), _mm512_set1_epi32(0xFF))); }
+
+    #elif defined(SS_SIMD_AVX2)
+
+        struct VMask { __m256  m; };
+        struct VInt  { __m256i i; };
+
+        struct VFloat
+        {
+            enum { kWidth = 8 };
+
+            VFloat() {}
+            VFloat(__m256 a) : v(a) {}
+            VFloat(float s)  : v(_mm256_set1_ps(s)) {}
+
+            __m256 v;
+        };
+
+        inline VFloat Load (const float* p)      { return _mm256_loadu_ps(p); }
+        inline void   Store(float* p, VFloat a)  { _mm256_storeu_ps(p, a.v); }
+        inline float  First(VFloat a)            { return _mm256_cvtss_f32(a.v); }
+
+        inline VFloat operator+(VFloat a, VFloat b) { return _mm256_add_ps(a.v, b.v); }
+        inline VFloat operator-(VFloat a, VFloat b) { return _mm256_sub_ps(a.v, b.v); }
+        inline VFloat operator*(VFloat a, VFloat b) { return _mm256_mul_ps(a.v, b.v); }
+        inline VFloat operator/(VFloat a, VFloat b) { return _mm256_div_ps(a.v, b.v); }
+        inline VFloat operator-(VFloat a)           { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+
+        inline VFloat Min (VFloat a, VFloat b) { return _mm256_min_ps(a.v, b.v); }
+        inline VFloat Max (VFloat a, VFloat b) { return _mm256_max_ps(a.v, b.v); }
+        inline VFloat Abs (VFloat a)           { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+        inline VFloat Sqrt(VFloat a)           { return _mm256_sqrt_ps(a.v); }
+        inline VFloat RSqrtEstimate(VFloat a)  { return _mm256_rsqrt_ps(a.v); }     // 12 bits
+
+    #ifdef __FMA__
+        inline VFloat MulAdd(VFloat a, VFloat b, VFloat c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+    #else
+        inline VFloat MulAdd(VFloat a, VFloat b, VFloat c) { return a * b + c; }
+    #endif
+
+        inline VMask operator< (VFloat a, VFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+        inline VMask operator> (VFloat a, VFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+
+        inline VFloat Select(VMask m, VFloat a, VFloat b) { return _mm256_blendv_ps(b.v, a.v, m.m); }   // m ? a : b
+
+        inline VInt   RoundToInt(VFloat a) { return { _mm256_cvtps_epi32(a.v) }; }
+        inline VInt   TruncToInt(VFloat a) { return { _mm256_cvttps_epi32(a.v) }; }
+        inline VFloat ToFloat   (VInt a)   { return _mm256_cvtepi32_ps(a.i); }
+        inline VFloat Pow2      (VInt n)   { return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n.i, _mm256_set1_epi32(127)), 23)); }
+
+        inline VFloat Gather(const float* table, VInt i) { return _mm256_i32gather_ps(table, i.i, 4); }   // table[i]
+
+        inline VInt   Load (const int32_t* p)       { return { _mm256_loadu_si256((const __m256i*) p) }; }
+        inline void   Store(int32_t* p, VInt a)     { _mm256_storeu_si256((__m256i*) p, a.i); }
+        inline VFloat ByteToFloat(VInt a, int byte) { return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(a.i, _mm_cvtsi32_si128(8 * byte)), _mm256_set1_epi32(0xFF))); }
+
+    #elif defined(SS_SIMD_SSE2)
+
+        struct VMask { __m128  m; };
+        struct VInt  { __m128i i; };
+
+        struct VFloat
+        {
+            enum { kWidth = 4 };
+
+            VFloat() {}
+            VFloat(__m128 a) : v(a) {}
+            VFloat(float s)  : v(_mm_set1_ps(s)) {}
+
+            __m128 v;
+        };
+
+        inline VFloat Load (const float* p)      { return _mm_loadu_ps(p); }
+        inline void   Store(float* p, VFloat a)  { _mm_storeu_ps(p, a.v); }
+        inline float  First(VFloat a)            { return _mm_cvtss_f32(a.v); }
+
+        inline VFloat operator+(VFloat a, VFloat b) { return _mm_add_ps(a.v, b.v); }
+        inline VFloat operator-(VFloat a, VFloat b) { return _mm_sub_ps(a.v, b.v); }
+        inline VFloat operator*(VFloat a, VFloat b) { return _mm_mul_ps(a.v, b.v); }
+        inline VFloat operator/(VFloat a, VFloat b) { return _mm_div_ps(a.v, b.v); }
+        inline VFloat operator-(VFloat a)           { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+
+        inline VFloat Min (VFloat a, VFloat b) { return _mm_min_ps(a.v, b.v); }
+        inline VFloat Max (VFloat a, VFloat b) { return _mm_max_ps(a.v, b.v); }
+        inline VFloat Abs (VFloat a)           { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+        inline VFloat Sqrt(VFloat a)           { return _mm_sqrt_ps(a.v); }
+        inline VFloat RSqrtEstimate(VFloat a)  { return _mm_rsqrt_ps(a.v); }        // 12 bits
+
+        inline VFloat MulAdd(VFloat a, VFloat b, VFloat c) { return a * b + c; }
+
+        inline VMask operator< (VFloat a, VFloat b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+        inline VMask operator> (VFloat a, VFloat b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+
+    #ifdef __SSE4_1__
+        inline VFloat Select(VMask m, VFloat a, VFloat b) { return _mm_blendv_ps(b.v, a.v, m.m); }
+    #else
+        inline VFloat Select(VMask m, VFloat a, VFloat b) { return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)); }
+    #endif
+
+        inline VInt   RoundToInt(VFloat a) { return { _mm_cvtps_epi32(a.v) }; }
+        inline VInt   TruncToInt(VFloat a) { return { _mm_cvttps_epi32(a.v) }; }
+        inline VFloat ToFloat   (VInt a)   { return _mm_cvtepi32_ps(a.i); }
+        inline VFloat Pow2      (VInt n)   { return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n.i, _mm_set1_epi32(127)), 23)); }
+
+        inline VFloat Gather(const float* table, VInt i)    // table[i], no gather instruction until AVX2
+        {
+            int32_t si[4];
+            _mm_storeu_si128((__m128i*) si, i.i);
+
+            return _mm_setr_ps(table[si[0]], table[si[1]], table[si[2]], table[si[3]]);
+        }
+
+        inline VInt   Load (const int32_t* p)       { return { _mm_loadu_si128((const __m128i*) p) }; }
+        inline void   Store(int32_t* p, VInt a)     { _mm_storeu_si128((__m128i*) p, a.i); }
+        inline VFloat ByteToFloat(VInt a, int byte) { return _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(a.i, _mm_cvtsi32_si128(8 * byte)), _mm_set1_epi32(0xFF))); }
+
+    #elif defined(SS_SIMD_NEON)
+
+        struct VMask { uint32x4_t  m; };
+        struct VInt  { int32x4_t   i; };
+
+        struct VFloat
+        {
+            enum { kWidth = 4 };
+
+            VFloat() {}
+            VFloat(float32x4_t a) : v(a) {}
+            VFloat(float s)       : v(vdupq_n_f32(s)) {}
+
+            float32x4_t v;
+        };
+
+        inline VFloat Load (const float* p)      { return vld1q_f32(p); }
+        inline void   Store(float* p, VFloat a)  { vst1q_f32(p, a.v); }
+        inline float  First(VFloat a)            { return vgetq_lane_f32(a.v, 0); }
+
+        inline VFloat operator+(VFloat a, VFloat b) { return vaddq_f32(a.v, b.v); }
+        inline VFloat operator-(VFloat a, VFloat b) { return vsubq_f32(a.v, b.v); }
+        inline VFloat operator*(VFloat a, VFloat b) { return vmulq_f32(a.v, b.v); }
+        inline VFloat operator/(VFloat a, VFloat b) { return vdivq_f32(a.v, b.v); }
+        inline VFloat operator-(VFloat a)           { return vnegq_f32(a.v); }
+
+        inline VFloat Min (VFloat a, VFloat b) { return vminq_f32(a.v, b.v); }
+        inline VFloat Max (VFloat a, VFloat b) { return vmaxq_f32(a.v, b.v); }
+        inline VFloat Abs (VFloat a)           { return vabsq_f32(a.v); }
+        inline VFloat Sqrt(VFloat a)           { return vsqrtq_f32(a.v); }
+
+        inline VFloat RSqrtEstimate(VFloat a)   // the hardware estimate is only 8 bits, so refine once to match x86
+        {
+            float32x4_t y = vrsqrteq_f32(a.v);
+            return vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(a.v, y), y));
+        }
+
+        inline VFloat MulAdd(VFloat a, VFloat b, VFloat c) { return vfmaq_f32(c.v, a.v, b.v); }
+
+        inline VMask operator< (VFloat a, VFloat b) { return { vcltq_f32(a.v, b.v) }; }
+        inline VMask operator> (VFloat a, VFloat b) { return { vcgtq_f32(a.v, b.v) }; }
+
+        inline VFloat Select(VMask m, VFloat a, VFloat b) { return vbslq_f32(m.m, a.v, b.v); }
+
+        inline VInt   RoundToInt(VFloat a) { return { vcvtnq_s32_f32(a.v) }; }
+        inline VInt   TruncToInt(VFloat a) { return { vcvtq_s32_f32(a.v) }; }
+        inline VFloat ToFloat   (VInt a)   { return vcvtq_f32_s32(a.i); }
+        inline VFloat Pow2      (VInt n)   { return vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(n.i, vdupq_n_s32(127)), 23)); }
+
+        inline VFloat Gather(const float* table, VInt i)    // table[i], no gather instruction
+        {
+            int32_t si[4];
+            vst1q_s32(si, i.i);
+
+            float t[4] = { table[si[0]], table[si[1]], table[si[2]], table[si[3]] };
+            return vld1q_f32(t);
+        }
+
+        inline VInt   Load (const int32_t* p)       { return { vld1q_s32(p) }; }
+        inline void   Store(int32_t* p, VInt a)     { vst1q_s32(p, a.i); }
+        inline VFloat ByteToFloat(VInt a, int byte) { return vcvtq_f32_u32(vandq_u32(vshlq_u32(vreinterpretq_u32_s32(a.i), vdupq_n_s32(-8 * byte)), vdupq_n_u32(0xFF))); }
+
+    #else
+
+        struct VMask { bool    m; };
+        struct VInt  { int32_t i; };
+
+        struct VFloat
+        {
+            enum { kWidth = 1 };
+
+            VFloat() {}
+            VFloat(float s) : v(s) {}
+
+            float v;
+        };
+
+        inline VFloat Load (const float* p)      { return *p; }
+        inline void   Store(float* p, VFloat a)  { *p = a.v; }
+        inline float  First(VFloat a)            { return a.v; }
+
+        inline VFloat operator+(VFloat a, VFloat b) { return a.v + b.v; }
+        inline VFloat operator-(VFloat a, VFloat b) { return a.v - b.v; }
+        inline VFloat operator*(VFloat a, VFloat b) { return a.v * b.v; }
+        inline VFloat operator/(VFloat a, VFloat b) { return a.v / b.v; }
+        inline VFloat operator-(VFloat a)           { return -a.v; }
+
+        inline VFloat Min (VFloat a, VFloat b) { return b.v < a.v ? b.v : a.v; }
+        inline VFloat Max (VFloat a, VFloat b) { return b.v > a.v ? b.v : a.v; }
+        inline VFloat Abs (VFloat a)           { return fabsf(a.v); }
+        inline VFloat Sqrt(VFloat a)           { return sqrtf(a.v); }
+        inline VFloat RSqrtEstimate(VFloat a)  { return 1.0f / sqrtf(a.v); }
+
+        inline VFloat MulAdd(VFloat a, VFloat b, VFloat c) { return a.v * b.v + c.v; }
+
+        inline VMask operator< (VFloat a, VFloat b) { return { a.v < b.v }; }
+        inline VMask operator> (VFloat a, VFloat b) { return { a.v > b.v }; }
+
+        inline VFloat Select(VMask m, VFloat a, VFloat b) { return m.m ? a : b; }
+
+        inline VInt   RoundToInt(VFloat a) { return { (int32_t) lrintf(a.v) }; }
+        inline VInt   TruncToInt(VFloat a) { return { (int32_t) a.v }; }
+        inline VFloat ToFloat   (VInt a)   { return float(a.i); }
+        inline VFloat Pow2      (VInt n)   { union { int32_t i; float f; } fi; fi.i = (n.i + 127) << 23; return fi.f; }
+
+        inline VFloat Gather(const float* table, VInt i) { return table[i.i]; }
+
+        inline VInt   Load (const int32_t* p)       { return { *p }; }
+        inline void   Store(int32_t* p, VInt a)     { *p = a.i; }
+        inline VFloat ByteToFloat(VInt a, int byte) { return float((uint32_t(a.i) >> (8 * byte)) & 0xFF); }
+
+    #endif
+
+        inline VFloat& operator+=(VFloat& a, VFloat b) { a = a + b; return a; }
+        inline VFloat& operator*=(VFloat& a, VFloat b) { a = a * b; return a; }
+
+        // Partial loads/stores for the tail of a batch, count <= kWidth. Unused lanes are zero.
+        inline VFloat LoadPartial(const float* p, size_t count)
+        {
+            float t[VFloat::kWidth] = { 0 };
+
+            for (size_t i = 0; i < count; i++)
+                t[i] = p[i];
+
+            return Load(t);
+        }
+
+        inline void StorePartial(float* p, VFloat a, size_t count)
+        {
+            float t[VFloat::kWidth];
+            Store(t, a);
+
+            for (size_t i = 0; i < count; i++)
+                p[i] = t[i];
+        }
+
+        inline VInt LoadPartial(const int32_t* p, size_t count)
+        {
+            int32_t t[VFloat::kWidth] = { 0 };
+
+            for (size_t i = 0; i < count; i++)
+                t[i] = p[i];
+
+            return Load(t);
+        }
+
+        inline void StorePartial(int32_t* p, VInt a, size_t count)
+        {
+            int32_t t[VFloat::kWidth];
+            Store(t, a);
+
+            for (size_t i = 0; i < count; i++)
+                p[i] = t[i];
+        }
+    }
+    }
+}
+
+#endif
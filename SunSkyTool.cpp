@@ -10,17 +10,33 @@
 #define _USE_MATH_DEFINES
 
 #include "SunSky.hpp"
+#include "SunSkyMath.h"
 
 #include <math.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #ifndef _MSC_VER
     #include <unistd.h>
     #include <strings.h>
+    #include <sys/stat.h>
+    #define fseek64 fseeko
 #else
-    #include <string.h>
     #define strcasecmp _stricmp
+    #define fseek64 _fseeki64
 #endif
 
 #include "stb_image_mini.h"
@@ -67,15 +83,6 @@ namespace
         );
     }
 
-    inline uint32_t RGBFToU32(Vec3f rgb)
-    {
-        return
-              0xFF000000
-            | (int) lrintf(saturate(rgb.x) * 255.0f) <<  0
-            | (int) lrintf(saturate(rgb.y) * 255.0f) <<  8
-            | (int) lrintf(saturate(rgb.z) * 255.0f) << 16;
-    }
-
     bool ArgCountError(const char* opt, int expected, int argc)
     {
         if (argc < expected)
@@ -95,231 +102,588 @@ namespace
         return (int) lrintf(ceil((1.0f - maxX) * width / 2.0f));
     }
 
-    Vec3f pow(Vec3f v, float n)
+    enum kToneMapType
+    {
+        kToneMapLinear,
+        kToneMapExponential,
+        kToneMapReinhard,
+        kNumToneMapTypes
+    };
+
+    struct MapInfo
+    {
+        float weight    = 5e-5f;
+        float gamma     = 2.2f;     // <= 0: linear output
+        bool  sRGB      = false;    // use sRGB curve rather than gamma
+        float hemiSign  = 1.0f;
+        bool  fisheye   = false;
+
+        kToneMapType toneMap = kToneMapLinear;
+    };
+
+    void ReportWrite(const char* fileName, bool success)
     {
-        return Vec3f(powf(v.x, n), powf(v.y, n), powf(v.z, n));
+        if (success)
+            printf("wrote %s\n", fileName);
+        else
+            printf("failed to write %s\n", fileName);
     }
 
-    Vec3f toneMapLinear(Vec3f c, float weight)
+    /// Writes a pfm file a group of rows at a time, in any order
+    class PFMStream
+    {
+    public:
+        bool Begin(const char* fileName, int width, int height);
+        bool WriteRows(int begin, int count, const Vec3f* rows);    ///< Writes rows [begin, begin + count), counting down from the top
+        bool End();
+
+    protected:
+        FILE*   mFile       = nullptr;
+        int     mWidth      = 0;
+        int     mHeight     = 0;
+        int64_t mDataStart  = 0;
+        bool    mSuccess    = false;
+    };
+
+    bool PFMStream::Begin(const char* fileName, int width, int height)
     {
-        return c * weight;
+        mFile = fopen(fileName, "wb");
+
+        if (!mFile)
+            return false;
+
+        fprintf(mFile, "PF\n");
+        fprintf(mFile, "%d %d\n", width, height);
+        fprintf(mFile, "-1.0\n");   // -ve = little endian
+
+        mWidth     = width;
+        mHeight    = height;
+        mDataStart = ftell(mFile);
+        mSuccess   = true;
+
+        return true;
     }
 
-    Vec3f toneMapExp(Vec3f c, float weight)
+    bool PFMStream::WriteRows(int begin, int count, const Vec3f* rows)
     {
-        return Vec3f(vl_one) - Vec3f(exp(-weight * c.x), exp(-weight * c.y), exp(-weight * c.z));
+        if (!mFile)
+            return false;
+
+        // pfm rows are stored bottom up
+        int64_t rowBytes = int64_t(mWidth) * sizeof(Vec3f);
+        int64_t offset = mDataStart + (mHeight - begin - count) * rowBytes;
+
+        if (fseek64(mFile, offset, SEEK_SET) != 0)
+            mSuccess = false;
+
+        for (int i = count - 1; i >= 0; i--)
+            if (fwrite(rows + size_t(i) * mWidth, sizeof(Vec3f), mWidth, mFile) != size_t(mWidth))
+                mSuccess = false;
+
+        return mSuccess;
     }
 
-    Vec3f toneMapReinhard(Vec3f c, float weight)
+    bool PFMStream::End()
     {
-        c *= weight;
-        return c / (Vec3f(vl_one) + c);
+        if (!mFile)
+            return false;
+
+        if (fclose(mFile) != 0)
+            mSuccess = false;
+
+        mFile = nullptr;
+
+        return mSuccess;
     }
+}
 
-    typedef Vec3f ToneMapFunc(Vec3f c, float weight);
 
-    enum kToneMapType
+//------------------------------------------------------------------------------
+// LDR encoding: sky evaluation, tone mapping, gamma and 8-bit quantization,
+// fused per row chunk. The tone map is applied in SIMD lanes, and gamma and
+// quantization done together via a table of the input values at which each
+// output code starts, so no pow() is needed per channel.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    using Math::VFloat;
+
+    // Tone map operators, applied to weighted channel values
+    struct ToneMapLinear
     {
-        kToneMapLinear,
-        kToneMapExponential,
-        kToneMapReinhard,
-        kNumToneMapTypes
+        VFloat operator()(VFloat c) const { return c; }
     };
 
-    ToneMapFunc* kToneMapFuncs[kNumToneMapTypes + 1] =
+    struct ToneMapExp
     {
-        toneMapLinear,
-        toneMapExp,
-        toneMapReinhard,
-        nullptr
+        VFloat operator()(VFloat c) const { return 1.0f - Math::Exp(-c); }
     };
 
-    struct MapInfo
+    struct ToneMapReinhard
     {
-        float weight    = 5e-5f;
-        float gamma     = 2.2f;
-        float hemiSign  = 1.0f;
-        bool  fisheye   = false;
+        VFloat operator()(VFloat c) const { return c / (1.0f + c); }
+    };
+
+    class LDREncoder
+    {
+    public:
+        LDREncoder(const MapInfo& mi);
+
+        /// Evaluates the sky for the given directions, and writes the corresponding RGBA8 pixels to 'row'
+        void SkyRow(const SunSky& sunSky, const Vec3f* dirs, uint32_t* row, size_t n) const;
+
+        /// SoA version of the above
+        void SkyRow(const SunSky& sunSky, const float* dx, const float* dy, const float* dz, uint32_t* row, size_t n) const;
+
+        /// Converts the given colours to RGBA8 pixels. 'rgb' is overwritten.
+        void Row(Vec3f* rgb, uint32_t* row, size_t n) const;
+
+        /// As Row(), but leaves 'rgb' untouched
+        void RowCopy(const Vec3f* rgb, uint32_t* row, size_t n) const;
 
-        ToneMapFunc* toneMap = toneMapLinear;
+        uint32_t Encode(float c) const;     ///< Returns 8-bit code for tone mapped value c, which must be in [0, 1]
+
+    protected:
+        template<class T_TONE_MAP> void RowT(Vec3f* rgb, uint32_t* row, size_t n) const;
+
+        static const size_t kChunk = 256;   // work in chunks of this many pixels, to stay in L1
+
+        // Table index is the float's exponent and top mantissa bits, covering [2^-kBucketOctaves, 1].
+        // Below that everything falls in bucket 0.
+        enum
+        {
+            kBucketBits    = 8,
+            kBucketShift   = 23 - kBucketBits,
+            kBucketOctaves = 32,
+            kBucketBase    = (127 - kBucketOctaves) << kBucketBits,
+            kNumBuckets    = (kBucketOctaves << kBucketBits) + 1
+        };
+
+        kToneMapType mToneMap;
+        float        mWeight;
+
+        float        mThresholds[257];          // mThresholds[i] = smallest input encoding to i
+        uint8_t      mBuckets[kNumBuckets];     // code for the start of each bucket
     };
 
-    bool PFMWrite(const char* filename, int width, int height, Vec3f* image)
+    LDREncoder::LDREncoder(const MapInfo& mi) :
+        mToneMap(mi.toneMap),
+        mWeight(mi.weight)
     {
-        FILE* f = fopen(filename, "w");
+        // Rounding boundary between codes i - 1 and i, mapped back through the inverse curve
+        for (int i = 1; i < 256; i++)
+        {
+            double e = (i - 0.5) / 255.0;
+            double c;
 
-        if (!f)
-            return false;
+            if (mi.sRGB)
+                c = e <= 0.04045 ? e / 12.92 : pow((e + 0.055) / 1.055, 2.4);
+            else if (mi.gamma > 0.0f)
+                c = pow(e, double(mi.gamma));
+            else
+                c = e;
+
+            mThresholds[i] = float(c);
+        }
 
-        fprintf(f, "PF\n");
-        fprintf(f, "%d %d\n", width, height);
-        fprintf(f, "-1.0\n");   // -ve = little endian
+        mThresholds[0]   = 0.0f;
+        mThresholds[256] = 2.0f;    // beyond any saturated input
 
-        image += width * height;
+        int code = 0;
 
-        for (int i = 0; i < height; i++)
+        for (int i = 0; i < kNumBuckets; i++)
         {
-            image -= width;
-            fwrite(image, sizeof(float) * 3, width, f);
+            uint32_t bits = i > 0 ? uint32_t(i + kBucketBase) << kBucketShift : 0;
+            float start;
+            memcpy(&start, &bits, sizeof(start));
+
+            while (start >= mThresholds[code + 1])
+                code++;
+
+            mBuckets[i] = uint8_t(code);
         }
+    }
+
+    inline uint32_t LDREncoder::Encode(float c) const
+    {
+        uint32_t bits;
+        memcpy(&bits, &c, sizeof(bits));
 
-        fclose(f);
+        int32_t bucket = int32_t(bits >> kBucketShift) - kBucketBase;
 
-        return true;
+        if (bucket < 0)
+            bucket = 0;
+        else if (bucket >= kNumBuckets)
+            bucket = kNumBuckets - 1;
+
+        // Buckets are narrower than the spacing between thresholds for gamma >= 1, so this
+        // usually runs at most once.
+        uint32_t code = mBuckets[bucket];
+
+        while (c >= mThresholds[code + 1])
+            code++;
+
+        return code;
+    }
+
+    template<class T_TONE_MAP> void LDREncoder::RowT(Vec3f* rgb, uint32_t* row, size_t n) const
+    {
+        using namespace SIMD;
+
+        // Channels are tone mapped independently, so treat as a flat array
+        float* c = &rgb[0].x;
+        size_t count = 3 * n;
+
+        const size_t kW = VFloat::kWidth;
+        const T_TONE_MAP toneMap = T_TONE_MAP();
+        const VFloat weight(mWeight);
+        size_t i = 0;
+
+        for ( ; i + kW <= count; i += kW)
+            Store(c + i, Min(Max(toneMap(Load(c + i) * weight), 0.0f), 1.0f));
+
+        if (i < count)
+            StorePartial(c + i, Min(Max(toneMap(LoadPartial(c + i, count - i) * weight), 0.0f), 1.0f), count - i);
+
+        for (size_t j = 0; j < n; j++)
+            row[j] =
+                  0xFF000000
+                | Encode(c[3 * j + 0]) <<  0
+                | Encode(c[3 * j + 1]) <<  8
+                | Encode(c[3 * j + 2]) << 16;
+    }
+
+    void LDREncoder::Row(Vec3f* rgb, uint32_t* row, size_t n) const
+    {
+        switch (mToneMap)
+        {
+        case kToneMapExponential:
+            RowT<ToneMapExp>(rgb, row, n);
+            break;
+        case kToneMapReinhard:
+            RowT<ToneMapReinhard>(rgb, row, n);
+            break;
+        default:
+            RowT<ToneMapLinear>(rgb, row, n);
+        }
+    }
+
+    void LDREncoder::RowCopy(const Vec3f* rgb, uint32_t* row, size_t n) const
+    {
+        Vec3f colours[kChunk];
+
+        for (size_t i = 0; i < n; i += kChunk)
+        {
+            size_t count = n - i < kChunk ? n - i : kChunk;
+
+            std::copy(rgb + i, rgb + i + count, colours);
+            Row(colours, row + i, count);
+        }
+    }
+
+    void LDREncoder::SkyRow(const SunSky& sunSky, const Vec3f* dirs, uint32_t* row, size_t n) const
+    {
+        Vec3f colours[kChunk];
+
+        for (size_t i = 0; i < n; i += kChunk)
+        {
+            size_t count = n - i < kChunk ? n - i : kChunk;
+
+            sunSky.SkyRGB(dirs + i, colours, count);
+            Row(colours, row + i, count);
+        }
+    }
+
+    void LDREncoder::SkyRow(const SunSky& sunSky, const float* dx, const float* dy, const float* dz, uint32_t* row, size_t n) const
+    {
+        float r[kChunk], g[kChunk], b[kChunk];
+        Vec3f colours[kChunk];
+
+        for (size_t i = 0; i < n; i += kChunk)
+        {
+            size_t count = n - i < kChunk ? n - i : kChunk;
+
+            sunSky.SkyRGB(dx + i, dy + i, dz + i, r, g, b, count);
+
+            for (size_t j = 0; j < count; j++)
+                colours[j] = Vec3f(r[j], g[j], b[j]);
+
+            Row(colours, row + i, count);
+        }
     }
 }
 
 
 //------------------------------------------------------------------------------
-// Projected (or fisheye) hemisphere in LDR (png) and HDR (pfm)
+// Parallel rendering. Images are split into fixed-size tiles of rows, which
+// are handed out to the pool's threads as they become free. Tile boundaries
+// don't depend on the thread count, and any reductions (e.g., cStats) are
+// summed per tile and then combined in order, so output is identical however
+// many threads are used.
 //------------------------------------------------------------------------------
 
 namespace
 {
-    /// Fill top-down projection of upper or lower hemisphere
-    void SkyToHemisphere(const SunSky& sunSky, int width, int height, uint8_t* data, int stride, const MapInfo& mi)
+    class TaskPool
     {
-        float invGamma = 1.0;
+    public:
+        TaskPool(int numThreads);   ///< Total threads including the caller's, <= 0 for one per core
+        ~TaskPool();
+
+        int NumThreads() const { return int(mThreads.size()) + 1; }
+
+        /// Calls task(i) for i in [0, numTasks) across the pool, including the calling thread, and returns when all are done
+        void Run(int numTasks, const std::function<void(int)>& task);
+
+    protected:
+        void WorkerLoop();
+        void Work();
+
+        std::vector<std::thread>            mThreads;
+        std::mutex                          mMutex;
+        std::condition_variable             mStartCV;
+        std::condition_variable             mDoneCV;
+
+        const std::function<void(int)>*     mTask       = nullptr;
+        int                                 mNumTasks   = 0;
+        std::atomic<int>                    mNextTask;
+        int                                 mNumBusy    = 0;
+        uint32_t                            mGeneration = 0;
+        bool                                mQuit       = false;
+    };
 
-        if (mi.gamma > 0.0)
-            invGamma = 1.0f / mi.gamma;
+    TaskPool::TaskPool(int numThreads) :
+        mNextTask(0)
+    {
+        if (numThreads <= 0)
+            numThreads = std::thread::hardware_concurrency();
 
-        data += (height - 1) * stride;
+        for (int i = 1; i < numThreads; i++)
+            mThreads.emplace_back(&TaskPool::WorkerLoop, this);
+    }
 
-        for (int i = 0; i < height; i++)
+    TaskPool::~TaskPool()
+    {
         {
-            uint32_t* row = (uint32_t*) data;
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQuit = true;
+        }
 
-            float y = 2.0f * (i + 0.5f) / height - 1.0f;
-            float y2 = y * y;
+        mStartCV.notify_all();
 
-            int sw = HemiInset(y2, width);
+        for (std::thread& thread : mThreads)
+            thread.join();
+    }
 
-            for (int j = sw; j < width - sw; j++)
-            {
-                float x = 2.0f * (j + 0.5f) / width - 1.0f;
-                float x2 = x * x;
-                float h2 = x2 + y2;
+    void TaskPool::Run(int numTasks, const std::function<void(int)>& task)
+    {
+        if (mThreads.empty() || numTasks <= 1)
+        {
+            for (int i = 0; i < numTasks; i++)
+                task(i);
+            return;
+        }
 
-                Vec3f v;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
 
-                if (mi.fisheye)
-                {
-                    float theta = vl_halfPi - vl_halfPi * sqrtf(h2);
-                    float phi = atan2f(y, x);
-                    v = Vec3f(cos(phi) * cos(theta), sin(phi) * cos(theta), sin(theta));
-                }
-                else
-                    v = Vec3f(x, y, mi.hemiSign * sqrtf(1.0f - h2));
+            mTask     = &task;
+            mNumTasks = numTasks;
+            mNextTask = 0;
+            mNumBusy  = int(mThreads.size());
+            mGeneration++;
+        }
+
+        mStartCV.notify_all();
+
+        Work();
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDoneCV.wait(lock, [this] { return mNumBusy == 0; });
 
-                Vec3f c = sunSky.SkyRGB(v);
+        mTask = nullptr;
+    }
+
+    void TaskPool::WorkerLoop()
+    {
+        uint32_t generation = 0;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mStartCV.wait(lock, [&] { return mQuit || mGeneration != generation; });
 
-                c = mi.toneMap(c, mi.weight);
-                c = pow(c, invGamma);
+                if (mQuit)
+                    return;
 
-                row[j] = RGBFToU32(c);
+                generation = mGeneration;
             }
 
-            // fill in surrounds
-        #ifdef EDGE_FILL
-            for (int j = 0; j < sw; j++)
-                row[j] = row[sw];
-            for (int j = width - sw; j < width; j++)
-                row[j] = row[width - sw - 1];
-        #else
-            for (int j = 0; j < sw; j++)
-                row[j] = 0xFF000000;
-            for (int j = width - sw; j < width; j++)
-                row[j] = 0xFF000000;
-        #endif
+            Work();
 
-            data -= stride;
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            if (--mNumBusy == 0)
+                mDoneCV.notify_one();
         }
     }
 
-    struct cStats
+    void TaskPool::Work()
     {
-        Vec3f avg;
-        Vec3f max;
-        Vec3f dev;
-    };
+        int i;
 
-    void SkyToHemisphere(const SunSky& sunSky, int width, int height, Vec3f* data, const MapInfo& mi, cStats* stats)
+        while ((i = mNextTask++) < mNumTasks)
+            (*mTask)(i);
+    }
+
+    const int kTileRows = 4;    // fixed, so results don't depend on thread count
+
+    inline int NumTiles(int height)
     {
-        Vec3f maxElts(vl_0);
-        Vec3f sumElts(vl_0);
-        Vec3f varElts(vl_0);
-        int samples = 0;
-        int stride = width;
+        return (height + kTileRows - 1) / kTileRows;
+    }
 
-        data += (height - 1) * stride;
+    /// Calls rows(image, rowBegin, rowEnd) for each tile of rows of numImages images of the given height, across the pool
+    void ForEachTile(TaskPool& pool, int numImages, int height, const std::function<void(int, int, int)>& rows)
+    {
+        int numTiles = NumTiles(height);
 
-        for (int i = 0; i < height; i++)
+        pool.Run(numImages * numTiles,
+            [&](int task)
+            {
+                int image = task / numTiles;
+                int begin = (task % numTiles) * kTileRows;
+                int end   = begin + kTileRows < height ? begin + kTileRows : height;
+
+                rows(image, begin, end);
+            }
+        );
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Views: the hemisphere, cube face and panorama projections, each given by
+// the directions for a row of the output, and the inverse mapping.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    /// Fills in the directions for row i of a view, counting up from the bottom, and returns the number of pixels
+    /// at either end of the row that are outside the view. Those are skipped, so dirs[0] is the first pixel inside.
+    typedef std::function<int(int i, Vec3f* dirs)> RowDirsFunc;
+
+    /// Finds the continuous pixel position (x, i) of direction v, with pixel centres at integers, and i counting up from
+    /// the bottom as above. Returns false if v is outside the view.
+    typedef std::function<bool(const Vec3f& v, float* x, float* i)> PixelAtFunc;
+
+    enum tProjection
+    {
+        kProjectionHemisphere,
+        kProjectionCubeFace,
+        kProjectionPanoramic
+    };
+
+    /// Identifies a view's directions, for caching them
+    struct ViewKey
+    {
+        tProjection projection;
+        int         width;
+        int         height;
+        int         options;    ///< projection-specific, e.g., cube face
+
+        bool operator<(const ViewKey& k) const
         {
-            Vec3f* row = data;
+            if (projection != k.projection)
+                return projection < k.projection;
+            if (width != k.width)
+                return width < k.width;
+            if (height != k.height)
+                return height < k.height;
+            return options < k.options;
+        }
+    };
+
+    class DirGrid;
+    struct SkyImage;
+
+    struct View
+    {
+        int         width;
+        int         height;
+        RowDirsFunc rowDirs;
+        PixelAtFunc pixelAt;
+        ViewKey     key;
+
+        std::shared_ptr<const DirGrid>  grid;   ///< If set, cached directions to use instead of rowDirs
+        std::shared_ptr<const SkyImage> sky;    ///< If set, precomputed colours to use instead of evaluating the sky
+    };
+
+    /// Top-down projection of upper or lower hemisphere
+    View HemisphereView(int width, int height, const MapInfo& mi)
+    {
+        float hemiSign = mi.hemiSign;
+        bool  fisheye  = mi.fisheye;
 
+        auto rowDirs = [=](int i, Vec3f* dirs)
+        {
             float y = 2.0f * (i + 0.5f) / height - 1.0f;
             float y2 = y * y;
 
             int sw = HemiInset(y2, width);
+            int n = 0;
 
-            for (int j = sw; j < width - sw; j++)
+            for (int j = sw; j < width - sw; j++, n++)
             {
                 float x = 2.0f * (j + 0.5f) / width - 1.0f;
                 float x2 = x * x;
                 float h2 = x2 + y2;
 
-                Vec3f v(x, y, mi.hemiSign * sqrtf(1.0f - h2));
-
-                Vec3f c = sunSky.SkyRGB(v);
-
-                if (stats)
+                if (fisheye)
                 {
-                    maxElts = MaxElts(maxElts, c);
-                    sumElts += c;
-                    varElts += c * c;
-                    samples++;
+                    float theta = vl_halfPi - vl_halfPi * sqrtf(h2);
+                    float phi = atan2f(y, x);
+                    dirs[n] = Vec3f(cos(phi) * cos(theta), sin(phi) * cos(theta), sin(theta));
                 }
+                else
+                    dirs[n] = Vec3f(x, y, hemiSign * sqrtf(1.0f - h2));
+            }
 
-                c *= mi.weight;
+            return sw;
+        };
 
-                row[j] = c;
-            }
+        auto pixelAt = [=](const Vec3f& v, float* x, float* i)
+        {
+            if (fisheye)
+            {
+                if (v.z < 0.0f)
+                    return false;
 
-        #ifdef EDGE_FILL
-            // fill in surrounds by replicating edge texels
-            for (int j = 0; j < sw; j++)
-                row[j] = row[sw];
-            for (int j = width - sw; j < width; j++)
-                row[j] = row[width - sw - 1];
-        #else
-            // fill in surrounds by replicating edge texels
-            for (int j = 0; j < sw; j++)
-                row[j] = vl_0;
-            for (int j = width - sw; j < width; j++)
-                row[j] = vl_0;
-        #endif
+                float h = sqrtf(v.x * v.x + v.y * v.y);
 
-            data -= stride;
-        }
+                // r = 1 - theta / (pi/2), where theta is the elevation
+                float s = h > 0.0f ? Math::Acos(v.z) / (vl_halfPi * h) : 0.0f;
 
-        if (stats)
-        {
-            stats->avg = sumElts / float(samples);
-            stats->max = maxElts;
-            varElts = varElts / float(samples) - sqr(stats->avg);
-            stats->dev = Vec3f(sqrtf(varElts.x), sqrtf(varElts.y), sqrtf(varElts.z));
-        }
-    }
-}
+                *x = (v.x * s + 1.0f) * 0.5f * width  - 0.5f;
+                *i = (v.y * s + 1.0f) * 0.5f * height - 0.5f;
+            }
+            else
+            {
+                if (v.z * hemiSign < 0.0f)
+                    return false;
 
+                *x = (v.x + 1.0f) * 0.5f * width  - 0.5f;
+                *i = (v.y + 1.0f) * 0.5f * height - 0.5f;
+            }
 
-//------------------------------------------------------------------------------
-// Cubemap generation in LDR (png) and HDR (pfm)
-//------------------------------------------------------------------------------
+            return true;
+        };
+
+        return { width, height, rowDirs, pixelAt, { kProjectionHemisphere, width, height, (hemiSign < 0.0f) | fisheye << 1 }, nullptr, nullptr };
+    }
 
-namespace
-{
     const int kFaceIndices[6][3] =
     {
         { 0, 2, 1 },
@@ -339,21 +703,12 @@ namespace
         { +1.0f, +1.0f, -1.0f },
     };
 
-    void SkyToCubeFace(const SunSky& sunSky, int face, int width, int height, uint8_t* data, int stride, const MapInfo& mi)
+    View CubeFaceView(int face, int width, int height)
     {
-        float invGamma = 1.0;
-
-        if (mi.gamma > 0.0)
-            invGamma = 1.0f / mi.gamma;
-
-        const float* signs   = kFaceSigns  [face];
-        const int*   indices = kFaceIndices[face];
-
-        data += (height - 1) * stride;
-
-        for (int i = 0; i < height; i++)
+        auto rowDirs = [=](int i, Vec3f* dirs)
         {
-            uint32_t* row = (uint32_t*) data;
+            const float* signs   = kFaceSigns  [face];
+            const int*   indices = kFaceIndices[face];
 
             for (int j = 0; j < width; j++)
             {
@@ -366,194 +721,2394 @@ namespace
                     signs[2] * facePos[indices[2]]
                 );
 
-                faceDir = norm(faceDir);
-                Vec3f faceColour = sunSky.SkyRGB(faceDir);
+                dirs[j] = norm(faceDir);
+            }
 
-                faceColour = mi.toneMap(faceColour, mi.weight);
-                faceColour = pow(faceColour, invGamma);
+            return 0;
+        };
 
-                row[j] = RGBFToU32(faceColour);
-            }
+        auto pixelAt = [=](const Vec3f& v, float* x, float* i)
+        {
+            const float* signs   = kFaceSigns  [face];
+            const int*   indices = kFaceIndices[face];
 
-            data -= stride;
-        }
-    }
+            Vec3f facePos;
 
-    void SkyToCubeFace(const SunSky& sunSky, int face, int width, int height, Vec3f* data, const MapInfo& mi)
-    {
-        const float* signs   = kFaceSigns  [face];
-        const int*   indices = kFaceIndices[face];
+            for (int k = 0; k < 3; k++)
+                facePos[indices[k]] = signs[k] * v[k];
 
-        int stride = width;
-        data += (height - 1) * stride;
+            if (facePos[2] <= 0.0f)
+                return false;
 
-        for (int i = 0; i < height; i++)
+            float a = facePos[0] / facePos[2];
+            float b = facePos[1] / facePos[2];
+
+            if (a < -1.0f || a > 1.0f || b < -1.0f || b > 1.0f)
+                return false;
+
+            *x = (a + 1.0f) * 0.5f * width  - 0.5f;
+            *i = (b + 1.0f) * 0.5f * height - 0.5f;
+
+            return true;
+        };
+
+        return { width, height, rowDirs, pixelAt, { kProjectionCubeFace, width, height, face }, nullptr, nullptr };
+    }
+
+    /// Equirectangular panorama
+    View PanoramicView(int width, int height)
+    {
+        auto rowDirs = [=](int i, Vec3f* dirs)
         {
-            Vec3f* row = data;
+            float dt = vl_twoPi / width;
+            float dp = vl_pi / height;
+
+            float theta = 0.5f * dt;
+            float phi = vl_pi - (i + 0.5f) * dp;
+
+            float sp = sinf(phi);
+            float cp = cosf(phi);
 
             for (int j = 0; j < width; j++)
             {
-                Vec3f facePos(2 * (j + 0.5f) / width - 1, 2 * (i + 0.5f) / height - 1, 1.0f);
+                float st = sinf(theta);
+                float ct = cosf(theta);
 
-                Vec3f faceDir
-                (
-                    signs[0] * facePos[indices[0]],
-                    signs[1] * facePos[indices[1]],
-                    signs[2] * facePos[indices[2]]
-                );
+                // middle of image is north, east to right, west to left, edges are south
+                dirs[j] = Vec3f(-st * sp, -ct * sp, cp);
+                theta += dt;
+            }
+
+            return 0;
+        };
+
+        auto pixelAt = [=](const Vec3f& v, float* x, float* i)
+        {
+            float theta = atan2f(-v.x, -v.y);
+
+            if (theta < 0.0f)
+                theta += vl_twoPi;
+
+            *x = theta * width / vl_twoPi - 0.5f;
+            *i = (vl_pi - Math::Acos(v.z)) * height / vl_pi - 0.5f;
+
+            return true;
+        };
+
+        return { width, height, rowDirs, pixelAt, { kProjectionPanoramic, width, height, 0 }, nullptr, nullptr };
+    }
+
+    /// A view's directions for every pixel, in SoA form, so that repeated renders of the view (e.g., movie frames)
+    /// only cost the sky evaluation. Rows are indexed from the bottom, as with RowDirsFunc.
+    class DirGrid
+    {
+    public:
+        DirGrid(TaskPool& pool, const View& view);
+
+        /// Returns the directions for row i, and its inset, as for RowDirsFunc
+        int Row(int i, const float** dx, const float** dy, const float** dz) const
+        {
+            size_t offset = size_t(i) * mWidth;
+
+            *dx = mX.data() + offset;
+            *dy = mY.data() + offset;
+            *dz = mZ.data() + offset;
+
+            return mInsets[i];
+        }
+
+        size_t Bytes() const { return (mX.size() + mY.size() + mZ.size()) * sizeof(float) + mInsets.size() * sizeof(int); }
+
+    protected:
+        int                 mWidth;
+        std::vector<float>  mX;
+        std::vector<float>  mY;
+        std::vector<float>  mZ;
+        std::vector<int>    mInsets;
+    };
+
+    DirGrid::DirGrid(TaskPool& pool, const View& view) :
+        mWidth(view.width),
+        mX(size_t(view.width) * view.height),
+        mY(size_t(view.width) * view.height),
+        mZ(size_t(view.width) * view.height),
+        mInsets(view.height)
+    {
+        ForEachTile(pool, 1, view.height,
+            [&](int, int begin, int end)
+            {
+                std::vector<Vec3f> dirs(mWidth);
+
+                for (int i = begin; i < end; i++)
+                {
+                    int sw = view.rowDirs(i, dirs.data());
+                    int n = mWidth - 2 * sw;
+                    size_t offset = size_t(i) * mWidth;
+
+                    for (int j = 0; j < n; j++)
+                    {
+                        mX[offset + j] = dirs[j].x;
+                        mY[offset + j] = dirs[j].y;
+                        mZ[offset + j] = dirs[j].z;
+                    }
+
+                    mInsets[i] = sw;
+                }
+            }
+        );
+    }
+
+    const size_t kMaxDirGridBytes = 256 << 20;   // total across all cached grids
+
+    /// Returns the cached directions for the given view, finding them first if necessary. Returns null if they don't
+    /// fit in the cache, e.g., for very large images, in which case the view's rowDirs should be used as normal.
+    std::shared_ptr<const DirGrid> FindDirGrid(TaskPool& pool, const View& view)
+    {
+        static std::mutex s_mutex;
+        static std::map<ViewKey, std::shared_ptr<const DirGrid>> s_grids;
+        static size_t s_bytes = 0;
+
+        std::lock_guard<std::mutex> lock(s_mutex);
+
+        auto it = s_grids.find(view.key);
+
+        if (it != s_grids.end())
+            return it->second;
+
+        size_t bytes = size_t(view.width) * view.height * 3 * sizeof(float);
+
+        if (s_bytes + bytes > kMaxDirGridBytes)
+            return nullptr;
+
+        std::shared_ptr<const DirGrid> grid = std::make_shared<DirGrid>(pool, view);
+
+        s_bytes += grid->Bytes();
+        s_grids[view.key] = grid;
+
+        return grid;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Rendering views in LDR and HDR, a range of rows at a time
+//------------------------------------------------------------------------------
+
+namespace
+{
+    struct cStats
+    {
+        Vec3f avg;
+        Vec3f max;
+        Vec3f dev;
+    };
+
+    struct cStatSums
+    {
+        Vec3f max = vl_0;
+        Vec3f sum = vl_0;
+        Vec3f sumSq = vl_0;
+        int   samples = 0;
+    };
+
+    /// Unweighted sky colours for every pixel of a view, and each row's inset, with rows indexed from the bottom as for
+    /// RowDirsFunc. Used in place of evaluating the sky, see MirrorSky().
+    struct SkyImage
+    {
+        int                 width;
+        std::vector<Vec3f>  colours;
+        std::vector<int>    insets;
+
+        const Vec3f* Row(int i) const { return colours.data() + size_t(i) * width; }
+    };
+
+    /// Renders rows [begin, end) of the view, counting down from the top, to LDR 'ldrRows' and/or HDR 'hdrRows', either
+    /// of which may be null. These hold row 'begin' on. Each direction is evaluated once, whichever outputs are wanted.
+    /// If 'sums' is given, the unweighted HDR values are accumulated into it.
+    void SkyRows(const SunSky& sunSky, const View& view, const LDREncoder& encoder, float weight, int begin, int end, uint32_t* ldrRows, Vec3f* hdrRows, cStatSums* sums)
+    {
+        int width = view.width;
+        const DirGrid*  grid = view.grid.get();
+        const SkyImage* sky  = view.sky.get();
+
+        std::vector<Vec3f> dirs(grid || sky ? 0 : width);
+        std::vector<float> rgb(grid && hdrRows ? 3 * width : 0);
+
+        for (int r = begin; r < end; r++)
+        {
+            uint32_t* ldrRow = ldrRows ? ldrRows + size_t(r - begin) * width : nullptr;
+            Vec3f*    hdrRow = hdrRows ? hdrRows + size_t(r - begin) * width : nullptr;
+
+            const float* dx = nullptr;
+            const float* dy = nullptr;
+            const float* dz = nullptr;
+
+            int i = view.height - 1 - r;
+            int sw;
+
+            if (sky)
+                sw = sky->insets[i];
+            else if (grid)
+                sw = grid->Row(i, &dx, &dy, &dz);
+            else
+                sw = view.rowDirs(i, dirs.data());
+
+            int n = width - 2 * sw;
+
+            if (hdrRow)
+            {
+                if (sky)
+                    std::copy(sky->Row(i) + sw, sky->Row(i) + sw + n, hdrRow + sw);
+                else if (grid)
+                {
+                    float* red   = rgb.data();
+                    float* green = red   + width;
+                    float* blue  = green + width;
+
+                    sunSky.SkyRGB(dx, dy, dz, red, green, blue, n);
+
+                    for (int j = 0; j < n; j++)
+                        hdrRow[sw + j] = Vec3f(red[j], green[j], blue[j]);
+                }
+                else
+                    sunSky.SkyRGB(dirs.data(), hdrRow + sw, n);
+
+                if (ldrRow)
+                    encoder.RowCopy(hdrRow + sw, ldrRow + sw, n);
+
+                for (int j = sw; j < width - sw; j++)
+                {
+                    Vec3f c = hdrRow[j];
+
+                    if (sums)
+                    {
+                        sums->max = MaxElts(sums->max, c);
+                        sums->sum += c;
+                        sums->sumSq += c * c;
+                        sums->samples++;
+                    }
+
+                    c *= weight;
+
+                    hdrRow[j] = c;
+                }
+
+            #ifdef EDGE_FILL
+                // fill in surrounds by replicating edge texels
+                for (int j = 0; j < sw; j++)
+                    hdrRow[j] = hdrRow[sw];
+                for (int j = width - sw; j < width; j++)
+                    hdrRow[j] = hdrRow[width - sw - 1];
+            #else
+                // fill in surrounds by replicating edge texels
+                for (int j = 0; j < sw; j++)
+                    hdrRow[j] = vl_0;
+                for (int j = width - sw; j < width; j++)
+                    hdrRow[j] = vl_0;
+            #endif
+            }
+            else if (ldrRow && sky)
+                encoder.RowCopy(sky->Row(i) + sw, ldrRow + sw, n);
+            else if (ldrRow && grid)
+                encoder.SkyRow(sunSky, dx, dy, dz, ldrRow + sw, n);
+            else if (ldrRow)
+                encoder.SkyRow(sunSky, dirs.data(), ldrRow + sw, n);
+
+            if (ldrRow)
+            {
+                // fill in surrounds
+            #ifdef EDGE_FILL
+                for (int j = 0; j < sw; j++)
+                    ldrRow[j] = ldrRow[sw];
+                for (int j = width - sw; j < width; j++)
+                    ldrRow[j] = ldrRow[width - sw - 1];
+            #else
+                for (int j = 0; j < sw; j++)
+                    ldrRow[j] = 0xFF000000;
+                for (int j = width - sw; j < width; j++)
+                    ldrRow[j] = 0xFF000000;
+            #endif
+            }
+        }
+    }
+
+    /// Combines per-tile sums, in order, so the result doesn't depend on scheduling
+    void FindStats(const std::vector<cStatSums>& tileSums, cStats* stats)
+    {
+        cStatSums sums;
+
+        for (const cStatSums& t : tileSums)
+        {
+            sums.max = MaxElts(sums.max, t.max);
+            sums.sum += t.sum;
+            sums.sumSq += t.sumSq;
+            sums.samples += t.samples;
+        }
+
+        stats->avg = sums.sum / float(sums.samples);
+        stats->max = sums.max;
+        Vec3f varElts = sums.sumSq / float(sums.samples) - sqr(stats->avg);
+        stats->dev = Vec3f(sqrtf(varElts.x), sqrtf(varElts.y), sqrtf(varElts.z));
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Mirror symmetry. All the sky models depend only on the angles to the zenith
+// and to the sun, so the sky is symmetric about the vertical plane through the
+// sun. Mirroring evaluates the half of each view on the sun's side of that
+// plane, and fills in the rest by reflection: copying where the reflected
+// direction lands on a pixel centre, and interpolating otherwise. Where the
+// reflection's neighbours weren't evaluated, e.g., next to the plane itself or
+// at the edge of a view, the direction is evaluated as normal. So is anywhere
+// the interpolation taps vary too much, which keeps the error under 0.5% of the
+// sky's peak.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    const float kMirrorExact        = 1e-3f;     // treat reflections this close to a pixel centre as exact
+    const float kMirrorMaxRange     = 0.05f;     // don't interpolate taps that vary by more than this fraction
+    const float kMirrorMaxPeakRange = 0.0075f;   // ... or by more than this fraction of the sky's peak
+
+    struct MirrorTarget
+    {
+        const View*                 view;
+        const SkyImage*             image;
+        const std::vector<uint8_t>* evaluated;
+        float                       maxRange;   ///< largest tap variation to interpolate
+    };
+
+    /// Samples the evaluated pixels of 'target' at continuous position (x, i). Returns false if any tap needed
+    /// wasn't evaluated, or the taps vary too much to interpolate accurately, e.g., near the sun or horizon.
+    bool MirrorSample(const MirrorTarget& target, float x, float i, Vec3f* c)
+    {
+        int width  = target.view->width;
+        int height = target.view->height;
+
+        // Positions are >= -0.5, so offset rather than using floorf, which is a library call without SSE4
+        int   x0 = int(x + 1.0f) - 1;
+        int   i0 = int(i + 1.0f) - 1;
+        float fx = x - x0;
+        float fi = i - i0;
+
+        if (fx > 1.0f - kMirrorExact)
+        {
+            x0++;
+            fx = 0.0f;
+        }
+        else if (fx < kMirrorExact)
+            fx = 0.0f;
+
+        if (fi > 1.0f - kMirrorExact)
+        {
+            i0++;
+            fi = 0.0f;
+        }
+        else if (fi < kMirrorExact)
+            fi = 0.0f;
+
+        // Exact reflections just use the one pixel
+        int x1 = fx > 0.0f ? x0 + 1 : x0;
+        int i1 = fi > 0.0f ? i0 + 1 : i0;
+
+        if (target.view->key.projection == kProjectionPanoramic)
+        {
+            if (x0 < 0)
+                x0 += width;
+            if (x1 >= width)
+                x1 -= width;
+        }
+
+        if (x0 < 0 || x1 >= width || i0 < 0 || i1 >= height)
+            return false;
+
+        size_t p00 = size_t(i0) * width + x0;
+        size_t p01 = size_t(i0) * width + x1;
+        size_t p10 = size_t(i1) * width + x0;
+        size_t p11 = size_t(i1) * width + x1;
+
+        const uint8_t* evaluated = target.evaluated->data();
+
+        if (!(evaluated[p00] & evaluated[p01] & evaluated[p10] & evaluated[p11]))
+            return false;
+
+        const Vec3f* colours = target.image->colours.data();
+
+        Vec3f c00 = colours[p00];
+        Vec3f c01 = colours[p01];
+        Vec3f c10 = colours[p10];
+        Vec3f c11 = colours[p11];
+
+        for (int e = 0; e < 3; e++)
+        {
+            float tapMax = fmaxf(fmaxf(c00[e], c01[e]), fmaxf(c10[e], c11[e]));
+            float tapMin = fminf(fminf(c00[e], c01[e]), fminf(c10[e], c11[e]));
+
+            if (tapMax - tapMin > fminf(kMirrorMaxRange * tapMax, target.maxRange))
+                return false;
+        }
+
+        Vec3f c0 = c00 + fx * (c01 - c00);
+        Vec3f c1 = c10 + fx * (c11 - c10);
+
+        *c = c0 + fi * (c1 - c0);
+        return true;
+    }
+
+    /// Finds unweighted sky colours for the given views by mirroring, and attaches them to the views. Views must be
+    /// the same size. Unlike normal rendering, the colours for each view are held in full, so memory use grows with
+    /// the image size. Returns the number of directions evaluated.
+    size_t MirrorSky(TaskPool& pool, const SunSky& sunSky, int numViews, View views[])
+    {
+        int width  = views[0].width;
+        int height = views[0].height;
+        size_t numPixels = size_t(width) * height;
+
+        // Normal to the plane through the sun and the zenith. With the sun at the zenith, any vertical plane will do.
+        Vec3f toSun = sunSky.SunDir();
+        Vec3f normal(-toSun.y, toSun.x, 0.0f);
+        float normalLen = len(normal);
+
+        normal = normalLen > 1e-6f ? normal / normalLen : Vec3f(1.0f, 0.0f, 0.0f);
+
+        std::vector<std::shared_ptr<SkyImage>> images(numViews);
+        std::vector<std::vector<uint8_t>>      evaluated(numViews);
+        std::vector<MirrorTarget>              targets(numViews);
+
+        for (int k = 0; k < numViews; k++)
+        {
+            images[k] = std::make_shared<SkyImage>();
+            images[k]->width = width;
+            images[k]->colours.resize(numPixels);
+            images[k]->insets.resize(height);
+
+            evaluated[k].resize(numPixels);
+
+            targets[k] = { &views[k], images[k].get(), &evaluated[k], 0.0f };
+        }
+
+        std::atomic<size_t> numEvaluated(0);
+        std::vector<float>  rowPeaks(size_t(numViews) * height, 0.0f);
+
+        // Evaluates the picked directions, and stores them to row i of view k
+        auto evaluate = [&](int k, int i, const Vec3f* picked, const int* columns, int count)
+        {
+            std::vector<Vec3f> colours(count);
+            sunSky.SkyRGB(picked, colours.data(), count);
+
+            Vec3f* row = images[k]->colours.data() + size_t(i) * width;
+            float& rowPeak = rowPeaks[size_t(k) * height + i];
+
+            for (int q = 0; q < count; q++)
+            {
+                row[columns[q]] = colours[q];
+                rowPeak = fmaxf(rowPeak, fmaxf(fmaxf(colours[q].x, colours[q].y), colours[q].z));
+            }
+
+            numEvaluated += count;
+        };
+
+        // Pixels off the sun's side, and where their reflections land, per row of each view
+        struct Reflection
+        {
+            int   column;
+            int   target;
+            float x;
+            float i;
+        };
+
+        std::vector<std::vector<Reflection>> reflections(size_t(numViews) * height);
+
+        // Column of the mirror plane on the sun's side, or -1 for non-panoramas
+        std::vector<float> panoramaColumns(numViews, -1.0f);
+
+        for (int k = 0; k < numViews; k++)
+        {
+            float i;
+
+            if (views[k].key.projection == kProjectionPanoramic)
+                views[k].pixelAt(Vec3f(-normal.y, normal.x, 0.0f), &panoramaColumns[k], &i);
+        }
+
+        // First evaluate the sun's side, and find the reflections of the rest
+        ForEachTile(pool, numViews, height,
+            [&](int k, int begin, int end)
+            {
+                float panoramaColumn = panoramaColumns[k];
+                std::vector<Vec3f> dirs(width);
+                std::vector<Vec3f> picked(width);
+                std::vector<int>   columns(width);
+
+                for (int r = begin; r < end; r++)
+                {
+                    int i = height - 1 - r;
+                    int sw = views[k].rowDirs(i, dirs.data());
+                    int count = 0;
+
+                    std::vector<Reflection>& rowReflections = reflections[size_t(k) * height + i];
+                    images[k]->insets[i] = sw;
+                    int lastTarget = k;
+
+                    for (int j = 0; j < width - 2 * sw; j++)
+                    {
+                        float d = dot(dirs[j], normal);
+
+                        if (d >= 0.0f)
+                        {
+                            picked [count] = dirs[j];
+                            columns[count] = sw + j;
+                            evaluated[k][size_t(i) * width + sw + j] = 1;
+                            count++;
+                            continue;
+                        }
+
+                        Reflection reflection = { sw + j, -1, 0.0f, 0.0f };
+
+                        if (panoramaColumn > -1.0f)
+                        {
+                            // Panoramas are linear in azimuth, so the reflection is on the same row
+                            reflection.target = k;
+                            reflection.x = 2.0f * panoramaColumn - reflection.column;
+                            reflection.i = float(i);
+
+                            if (reflection.x < -0.5f)
+                                reflection.x += width;
+                            if (reflection.x >= width - 0.5f)
+                                reflection.x -= width;
+
+                            rowReflections.push_back(reflection);
+                            continue;
+                        }
+
+                        Vec3f mirrored = dirs[j] - 2.0f * d * normal;
+
+                        // Neighbouring reflections mostly land in the same view, so try the last one first
+                        for (int n = 0; n < numViews; n++)
+                        {
+                            int t = (lastTarget + n) % numViews;
+
+                            if (views[t].pixelAt(mirrored, &reflection.x, &reflection.i))
+                            {
+                                reflection.target = lastTarget = t;
+                                break;
+                            }
+                        }
+
+                        rowReflections.push_back(reflection);
+                    }
+
+                    evaluate(k, i, picked.data(), columns.data(), count);
+                }
+            }
+        );
+
+        // The sun's side holds the peak of the whole sky, which bounds the interpolation error allowed
+        float peak = *std::max_element(rowPeaks.begin(), rowPeaks.end());
+
+        for (MirrorTarget& target : targets)
+            target.maxRange = kMirrorMaxPeakRange * peak;
+
+        // Then fill in the reflections. These are done in square blocks, as the reflections of a row run across many
+        // rows of the target, and visiting a whole row's worth at a time thrashes the cache.
+        const int kBlock = 64;
+
+        int blocksAcross = (width  + kBlock - 1) / kBlock;
+        int blocksDown   = (height + kBlock - 1) / kBlock;
+        int blocksPerView = blocksAcross * blocksDown;
+
+        std::vector<std::vector<uint8_t>> failed(numViews);
+
+        for (int k = 0; k < numViews; k++)
+            failed[k].resize(numPixels);
+
+        pool.Run(numViews * blocksPerView,
+            [&](int task)
+            {
+                int k  = task / blocksPerView;
+                int i0 = (task % blocksPerView) / blocksAcross * kBlock;
+                int j0 = (task % blocksAcross) * kBlock;
+                int i1 = std::min(i0 + kBlock, height);
+                int j1 = std::min(j0 + kBlock, width);
+
+                for (int i = i0; i < i1; i++)
+                {
+                    const std::vector<Reflection>& rowReflections = reflections[size_t(k) * height + i];
+                    Vec3f*   row       = images[k]->colours.data() + size_t(i) * width;
+                    uint8_t* rowFailed = failed[k].data() + size_t(i) * width;
+
+                    auto it = std::lower_bound(rowReflections.begin(), rowReflections.end(), j0,
+                        [](const Reflection& reflection, int column) { return reflection.column < column; });
+
+                    for (; it != rowReflections.end() && it->column < j1; ++it)
+                        if (it->target < 0 || !MirrorSample(targets[it->target], it->x, it->i, &row[it->column]))
+                            rowFailed[it->column] = 1;
+                }
+            }
+        );
+
+        // Finally evaluate wherever mirroring failed
+        ForEachTile(pool, numViews, height,
+            [&](int k, int begin, int end)
+            {
+                std::vector<Vec3f> dirs(width);
+                std::vector<Vec3f> picked(width);
+                std::vector<int>   columns(width);
+
+                for (int r = begin; r < end; r++)
+                {
+                    int i = height - 1 - r;
+                    int count = 0;
+
+                    const uint8_t* rowFailed = failed[k].data() + size_t(i) * width;
+
+                    for (int j = 0; j < width; j++)
+                        if (rowFailed[j])
+                            columns[count++] = j;
+
+                    if (count == 0)
+                        continue;
+
+                    int sw = views[k].rowDirs(i, dirs.data());
+
+                    for (int q = 0; q < count; q++)
+                        picked[q] = dirs[columns[q] - sw];
+
+                    evaluate(k, i, picked.data(), columns.data(), count);
+                }
+            }
+        );
+
+        for (int k = 0; k < numViews; k++)
+            views[k].sky = images[k];
+
+        return numEvaluated;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Panorama cache. Changing only the sun's azimuth rotates the sky about the
+// zenith, which for a panorama is a horizontal shift. So panoramas are cached
+// by everything else they depend on, and a request that differs only in
+// azimuth is met by shifting the cached panorama's columns. As with
+// mirroring, fractional shifts are interpolated, and directions are evaluated
+// where the interpolation would be inaccurate.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    const size_t kMaxPanoramaCacheBytes = 256 << 20;    // total across all cached panoramas
+
+    /// Identifies a panorama up to the sun's azimuth
+    struct PanoramaKey
+    {
+        tSkyType    skyType;
+        int         width;
+        int         height;
+        float       params[7];  ///< sun elevation (as z), turbidity, albedo, overcast, roughness
+
+        PanoramaKey(const SunSky& sunSky, const View& view) :
+            skyType(sunSky.SkyType()),
+            width(view.width),
+            height(view.height),
+            params
+            {
+                sunSky.SunDir().z,
+                sunSky.Turbidity(),
+                sunSky.Albedo().x,
+                sunSky.Albedo().y,
+                sunSky.Albedo().z,
+                sunSky.Overcast(),
+                sunSky.Roughness()
+            }
+        {}
+
+        bool operator<(const PanoramaKey& k) const
+        {
+            if (skyType != k.skyType)
+                return skyType < k.skyType;
+            if (width != k.width)
+                return width < k.width;
+            if (height != k.height)
+                return height < k.height;
+            return std::lexicographical_compare(params, params + 7, k.params, k.params + 7);
+        }
+    };
+
+    struct PanoramaEntry
+    {
+        std::shared_ptr<const SkyImage> image;
+        float                           sunColumn;  ///< x position of the sun's azimuth in image
+        float                           peak;       ///< largest channel value in image
+    };
+
+    /// Returns the x position of the sun's azimuth in panorama view
+    float SunColumn(const SunSky& sunSky, const View& view)
+    {
+        Vec3f toSun = sunSky.SunDir();
+        Vec3f horizontal(toSun.x, toSun.y, 0.0f);
+        float x = 0.0f;
+        float i;
+
+        // With the sun at the zenith, the sky is the same at any azimuth
+        if (sqrlen(horizontal) > 1e-12f)
+            view.pixelAt(horizontal, &x, &i);
+
+        return x;
+    }
+
+    /// Evaluates the unweighted sky colours for every pixel of view
+    std::shared_ptr<SkyImage> RenderSky(TaskPool& pool, const SunSky& sunSky, const View& view)
+    {
+        int width  = view.width;
+        int height = view.height;
+
+        std::shared_ptr<SkyImage> image = std::make_shared<SkyImage>();
+        image->width = width;
+        image->colours.resize(size_t(width) * height);
+        image->insets.resize(height);
+
+        ForEachTile(pool, 1, height,
+            [&](int, int begin, int end)
+            {
+                std::vector<Vec3f> dirs(width);
+
+                for (int r = begin; r < end; r++)
+                {
+                    int i  = height - 1 - r;
+                    int sw = view.rowDirs(i, dirs.data());
+
+                    image->insets[i] = sw;
+                    sunSky.SkyRGB(dirs.data(), image->colours.data() + size_t(i) * width + sw, width - 2 * sw);
+                }
+            }
+        );
+
+        return image;
+    }
+
+    /// Returns the largest channel value in 'image'
+    float ImagePeak(const SkyImage& image)
+    {
+        float peak = 0.0f;
+
+        for (const Vec3f& c : image.colours)
+            peak = fmaxf(peak, fmaxf(fmaxf(c.x, c.y), c.z));
+
+        return peak;
+    }
+
+    /// Returns panorama 'image', with peak channel value 'peak', shifted right by 'shift' columns, wrapping around.
+    /// Where interpolation would be inaccurate, as for MirrorSample(), the colours are evaluated from sunSky instead,
+    /// and counted in numEvaluated.
+    std::shared_ptr<SkyImage> ShiftPanorama(TaskPool& pool, const SunSky& sunSky, const View& view, const SkyImage& image, float peak, float shift, size_t* numEvaluated)
+    {
+        int width  = view.width;
+        int height = view.height;
+
+        shift = fmodf(shift, float(width));
+
+        if (shift < 0.0f)
+            shift += width;
+
+        int   n = int(shift);
+        float f = shift - n;
+
+        if (f > 1.0f - kMirrorExact)
+        {
+            n = (n + 1) % width;
+            f = 0.0f;
+        }
+        else if (f < kMirrorExact)
+            f = 0.0f;
+
+        std::shared_ptr<SkyImage> result = std::make_shared<SkyImage>();
+        result->width = width;
+        result->colours.resize(size_t(width) * height);
+        result->insets = image.insets;
+
+        float maxRange = kMirrorMaxPeakRange * peak;
+        std::atomic<size_t> evaluated(0);
+
+        ForEachTile(pool, 1, height,
+            [&](int, int begin, int end)
+            {
+                std::vector<Vec3f> dirs(width);
+                std::vector<Vec3f> picked(width);
+                std::vector<Vec3f> colours(width);
+                std::vector<int>   columns(width);
+
+                for (int r = begin; r < end; r++)
+                {
+                    int i = height - 1 - r;
+                    int count = 0;
+
+                    const Vec3f* src = image.Row(i);
+                    Vec3f*       dst = result->colours.data() + size_t(i) * width;
+
+                    for (int j = 0; j < width; j++)
+                    {
+                        // dst[j] lies at j - shift in src, between columns j - n - 1 and j - n
+                        int j1 = j - n;
+
+                        if (j1 < 0)
+                            j1 += width;
+
+                        if (f == 0.0f)
+                        {
+                            dst[j] = src[j1];
+                            continue;
+                        }
+
+                        int j0 = j1 > 0 ? j1 - 1 : width - 1;
+
+                        Vec3f c0 = src[j0];
+                        Vec3f c1 = src[j1];
+                        bool  smooth = true;
+
+                        // The outer neighbours are checked too, to catch a peak falling between the taps
+                        Vec3f cl = src[j0 > 0 ? j0 - 1 : width - 1];
+                        Vec3f cr = src[j1 < width - 1 ? j1 + 1 : 0];
+
+                        for (int e = 0; e < 3; e++)
+                        {
+                            float tapMax = fmaxf(fmaxf(cl[e], c0[e]), fmaxf(c1[e], cr[e]));
+                            float tapMin = fminf(fminf(cl[e], c0[e]), fminf(c1[e], cr[e]));
+
+                            if (tapMax - tapMin > fminf(kMirrorMaxRange * tapMax, maxRange))
+                                smooth = false;
+                        }
+
+                        if (smooth)
+                            dst[j] = c1 + f * (c0 - c1);
+                        else
+                            columns[count++] = j;
+                    }
+
+                    if (count == 0)
+                        continue;
+
+                    view.rowDirs(i, dirs.data());   // panoramas have no inset
+
+                    for (int q = 0; q < count; q++)
+                        picked[q] = dirs[columns[q]];
+
+                    sunSky.SkyRGB(picked.data(), colours.data(), count);
+
+                    for (int q = 0; q < count; q++)
+                        dst[columns[q]] = colours[q];
+
+                    evaluated += count;
+                }
+            }
+        );
+
+        if (numEvaluated)
+            *numEvaluated = evaluated;
+
+        return result;
+    }
+
+    /// Returns the unweighted sky colours for panorama 'view'. If a panorama has already been found for the same sun
+    /// elevation, sky type and settings, it's shifted to the current sun azimuth rather than re-evaluated. Otherwise
+    /// the panorama is rendered, via mirroring if requested, and cached if it fits under kMaxPanoramaCacheBytes.
+    /// Optionally returns the number of directions evaluated.
+    std::shared_ptr<const SkyImage> FindPanorama(TaskPool& pool, const SunSky& sunSky, const View& view, bool mirror, size_t* numEvaluated)
+    {
+        static std::mutex s_mutex;
+        static std::map<PanoramaKey, PanoramaEntry> s_panoramas;
+        static size_t s_bytes = 0;
+
+        PanoramaKey key(sunSky, view);
+        float sunColumn = SunColumn(sunSky, view);
+        PanoramaEntry cached;
+
+        {
+            std::lock_guard<std::mutex> lock(s_mutex);
+
+            auto it = s_panoramas.find(key);
+
+            if (it != s_panoramas.end())
+                cached = it->second;
+        }
+
+        if (cached.image)
+            return ShiftPanorama(pool, sunSky, view, *cached.image, cached.peak, sunColumn - cached.sunColumn, numEvaluated);
+
+        std::shared_ptr<const SkyImage> image;
+        size_t evaluated;
+
+        if (mirror)
+        {
+            View mirrored = view;
+            evaluated = MirrorSky(pool, sunSky, 1, &mirrored);
+            image = mirrored.sky;
+        }
+        else
+        {
+            image = RenderSky(pool, sunSky, view);
+            evaluated = image->colours.size();
+        }
+
+        if (numEvaluated)
+            *numEvaluated = evaluated;
+
+        size_t bytes = image->colours.size() * sizeof(Vec3f);
+
+        std::lock_guard<std::mutex> lock(s_mutex);
+
+        if (s_bytes + bytes <= kMaxPanoramaCacheBytes && s_panoramas.find(key) == s_panoramas.end())
+        {
+            s_bytes += bytes;
+            s_panoramas[key] = { image, sunColumn, ImagePeak(*image) };
+        }
+
+        return image;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Streaming output. Views are rendered in horizontal bands, a group of bands
+// at a time into a reused buffer, and each group is then compressed and
+// written before the next is started. Memory use is bounded regardless of
+// image size. When both png and pfm files are wanted, they're produced in the
+// same pass.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    const int    kBandRows          = 16;           // multiple of kTileRows
+    const size_t kMaxBandGroupBytes = 64 << 20;
+
+    /// The bands of each view in turn, for views of possibly differing heights
+    struct BandLayout
+    {
+        std::vector<int> heights;
+        std::vector<int> firstBands;    ///< per view, plus the total number of bands at the end
+
+        BandLayout(int numViews, const ::View views[]) : heights(numViews), firstBands(numViews + 1, 0)
+        {
+            for (int k = 0; k < numViews; k++)
+            {
+                heights[k] = views[k].height;
+                firstBands[k + 1] = firstBands[k] + (heights[k] + kBandRows - 1) / kBandRows;
+            }
+        }
+
+        int NumBands() const { return firstBands.back(); }
+
+        int View (int band) const { return int(std::upper_bound(firstBands.begin(), firstBands.end(), band) - firstBands.begin()) - 1; }
+        int Begin(int band) const { return (band - firstBands[View(band)]) * kBandRows; }
+        int Rows (int band) const { int h = heights[View(band)]; int b = Begin(band); return b + kBandRows < h ? kBandRows : h - b; }
+        bool Last(int band) const { return band == firstBands[View(band) + 1] - 1; }
+    };
+
+    /// Renders the given views to png and/or pfm files, in bands, with all views rendered concurrently. Either list of
+    /// file names, or any entry in it, may be null to skip that output. Optionally finds stats across all views, in
+    /// which case pfm output is required.
+    bool SkyToFiles
+    (
+        TaskPool&           pool,
+        const SunSky&       sunSky,
+        int                 numViews,
+        const View          views[],
+        const char* const   namesPNG[],
+        const char* const   namesPFM[],
+        const MapInfo&      mi,
+        cStats*             stats
+    )
+    {
+        VL_ASSERT(namesPFM || !stats);
+
+        LDREncoder encoder(mi);
+
+        BandLayout layout(numViews, views);
+
+        const int kTilesPerBand = kBandRows / kTileRows;
+
+        // Start of each view's tiles in tileSums
+        std::vector<int> firstTiles(numViews + 1, 0);
+        int maxWidth = 0;
+
+        for (int k = 0; k < numViews; k++)
+        {
+            firstTiles[k + 1] = firstTiles[k] + NumTiles(views[k].height);
+            maxWidth = std::max(maxWidth, views[k].width);
+        }
+
+        // Reused band buffers, each big enough for the widest view
+        size_t bandSize = size_t(kBandRows) * maxWidth;
+        size_t pixelBytes = (namesPNG ? sizeof(uint32_t) : 0) + (namesPFM ? sizeof(Vec3f) : 0);
+        int groupSize = pool.NumThreads();
+
+        if (groupSize * bandSize * pixelBytes > kMaxBandGroupBytes)
+            groupSize = int(kMaxBandGroupBytes / (bandSize * pixelBytes));
+        if (groupSize < 1)
+            groupSize = 1;
+
+        std::vector<uint32_t>      ldrBuffer(namesPNG ? groupSize * bandSize : 0);
+        std::vector<Vec3f>         hdrBuffer(namesPFM ? groupSize * bandSize : 0);
+        std::vector<stbi_png_band> compressedBands(groupSize);
+        std::vector<uint8_t>       compressed(groupSize);
+        std::vector<cStatSums>     tileSums(stats ? firstTiles[numViews] : 0);
+
+        stbi_png_stream streamPNG = {};
+        PFMStream       streamPFM;
+        bool successPNG = true;
+        bool successPFM = true;
+        bool success = true;
+
+        int numBands = layout.NumBands();
+
+        for (int firstBand = 0; firstBand < numBands; firstBand += groupSize)
+        {
+            int count = numBands - firstBand < groupSize ? numBands - firstBand : groupSize;
+
+            pool.Run(count * kTilesPerBand,
+                [&](int task)
+                {
+                    int k = task / kTilesPerBand;
+                    int band = firstBand + k;
+                    int view = layout.View(band);
+                    int height = views[view].height;
+
+                    int bandBegin = layout.Begin(band);
+                    int begin = bandBegin + (task % kTilesPerBand) * kTileRows;
+                    int end = begin + kTileRows < height ? begin + kTileRows : height;
+
+                    bool wantPNG = namesPNG && namesPNG[view];
+                    bool wantPFM = namesPFM && namesPFM[view];
+
+                    if (begin >= end || !(wantPNG || wantPFM))
+                        return;
+
+                    size_t offset = k * bandSize + size_t(begin - bandBegin) * views[view].width;
+
+                    SkyRows
+                    (
+                        sunSky, views[view], encoder, mi.weight, begin, end,
+                        wantPNG ? ldrBuffer.data() + offset : nullptr,
+                        wantPFM ? hdrBuffer.data() + offset : nullptr,
+                        stats ? &tileSums[firstTiles[view] + begin / kTileRows] : nullptr
+                    );
+                }
+            );
+
+            // Compression is the bulk of the png work, so is done in parallel too
+            if (namesPNG)
+                pool.Run(count,
+                    [&](int k)
+                    {
+                        int band = firstBand + k;
+                        int view = layout.View(band);
+                        int width = views[view].width;
+
+                        if (!namesPNG[view])
+                            return;
+
+                        compressed[k] = stbi_write_png_compress_band(&compressedBands[k], ldrBuffer.data() + k * bandSize, 0, width, layout.Rows(band), 4, layout.Last(band));
+                    }
+                );
+
+            for (int k = 0; k < count; k++)
+            {
+                int band = firstBand + k;
+                int view = layout.View(band);
+                int width  = views[view].width;
+                int height = views[view].height;
+
+                if (namesPNG && namesPNG[view])
+                {
+                    if (layout.Begin(band) == 0)
+                        successPNG = stbi_write_png_begin(&streamPNG, namesPNG[view], width, height, 4) != 0;
+
+                    if (compressed[k])
+                        successPNG = stbi_write_png_band(&streamPNG, &compressedBands[k]) && successPNG;
+                    else
+                        successPNG = false;
+
+                    if (layout.Last(band))
+                    {
+                        successPNG = stbi_write_png_end(&streamPNG) && successPNG;
+                        ReportWrite(namesPNG[view], successPNG);
+                        success = success && successPNG;
+                    }
+                }
+
+                if (namesPFM && namesPFM[view])
+                {
+                    if (layout.Begin(band) == 0)
+                        successPFM = streamPFM.Begin(namesPFM[view], width, height);
+
+                    successPFM = streamPFM.WriteRows(layout.Begin(band), layout.Rows(band), hdrBuffer.data() + k * bandSize) && successPFM;
+
+                    if (layout.Last(band))
+                    {
+                        successPFM = streamPFM.End() && successPFM;
+                        ReportWrite(namesPFM[view], successPFM);
+                        success = success && successPFM;
+                    }
+                }
+            }
+        }
+
+        if (stats)
+            FindStats(tileSums, stats);
+
+        return success;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Roughness map: hemisphere with roughness varying from 0 to 1 left to right.
+// Exercises the batch SunSky::ConvolvedSkyRGB path.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    /// Fill top-down projection of upper or lower hemisphere, with roughness increasing along x. Returns samples evaluated.
+    int SkyToRoughnessMap(const SunSky& sunSky, int width, int height, uint8_t* data, int stride, const MapInfo& mi)
+    {
+        std::vector<float> dx(width), dy(width), dz(width), dr(width);
+        std::vector<float> cr(width), cg(width), cb(width);
+        std::vector<Vec3f> colours(width);
+
+        LDREncoder encoder(mi);
+
+        int samples = 0;
+
+        data += (height - 1) * stride;
+
+        for (int i = 0; i < height; i++)
+        {
+            uint32_t* row = (uint32_t*) data;
+
+            float y = 2.0f * (i + 0.5f) / height - 1.0f;
+            float y2 = y * y;
+
+            int sw = HemiInset(y2, width);
+            int n = 0;
+
+            for (int j = sw; j < width - sw; j++, n++)
+            {
+                float x = 2.0f * (j + 0.5f) / width - 1.0f;
+                float x2 = x * x;
+                float h2 = x2 + y2;
+
+                if (mi.fisheye)
+                {
+                    float theta = vl_halfPi - vl_halfPi * sqrtf(h2);
+                    float phi = atan2f(y, x);
+
+                    dx[n] = cos(phi) * cos(theta);
+                    dy[n] = sin(phi) * cos(theta);
+                    dz[n] = sin(theta);
+                }
+                else
+                {
+                    dx[n] = x;
+                    dy[n] = y;
+                    dz[n] = mi.hemiSign * sqrtf(1.0f - h2);
+                }
+
+                dr[n] = (j + 0.5f) / width;
+            }
+
+            sunSky.ConvolvedSkyRGB(dx.data(), dy.data(), dz.data(), dr.data(), cr.data(), cg.data(), cb.data(), n);
+            samples += n;
+
+            for (int j = 0; j < sw; j++)
+                row[j] = 0xFF000000;
+
+            for (int j = 0; j < n; j++)
+                colours[j] = Vec3f(cr[j], cg[j], cb[j]);
+
+            encoder.Row(colours.data(), row + sw, n);
+
+            for (int j = width - sw; j < width; j++)
+                row[j] = 0xFF000000;
+
+            data -= stride;
+        }
+
+        return samples;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// YUV 4:2:0 conversion and Y4M output, so movie frames leave the tool already
+// subsampled: 1.5 bytes per pixel rather than 4 for RGBA.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    // BT.709 luma weights, and limited ("TV") range scales for 8-bit codes
+    const float kLumaR    = 0.2126f;
+    const float kLumaG    = 0.7152f;
+    const float kLumaB    = 0.0722f;
+    const float kLumaScale = 219.0f / 255.0f;
+    const float kCbScale   = 224.0f / 255.0f / 1.8556f;    // 1.8556 = 2 (1 - kLumaB)
+    const float kCrScale   = 224.0f / 255.0f / 1.5748f;    // 1.5748 = 2 (1 - kLumaR)
+
+    inline size_t YUV420Size(int width, int height)
+    {
+        return size_t(width) * height + 2 * size_t((width + 1) / 2) * ((height + 1) / 2);
+    }
+
+    /// Converts a row of RGBA8 pixels to Y codes, and adds Cb and Cr, unoffset and at full resolution, to cbRow/crRow
+    void YCbCrRow(const uint32_t* row, int32_t* yRow, float* cbRow, float* crRow, size_t n)
+    {
+        using namespace SIMD;
+
+        const size_t kW = VFloat::kWidth;
+        const int32_t* p = (const int32_t*) row;
+
+        auto convert = [](VInt c, VInt& y, VFloat& cb, VFloat& cr)
+        {
+            VFloat r = ByteToFloat(c, 0);
+            VFloat g = ByteToFloat(c, 1);
+            VFloat b = ByteToFloat(c, 2);
+
+            VFloat luma = kLumaR * r + kLumaG * g + kLumaB * b;
+
+            y  = RoundToInt(MulAdd(luma, kLumaScale, 16.0f));
+            cb = (b - luma) * kCbScale;
+            cr = (r - luma) * kCrScale;
+        };
+
+        VInt y;
+        VFloat cb, cr;
+        size_t i = 0;
+
+        for ( ; i + kW <= n; i += kW)
+        {
+            convert(Load(p + i), y, cb, cr);
+
+            Store(yRow + i, y);
+            Store(cbRow + i, Load(cbRow + i) + cb);
+            Store(crRow + i, Load(crRow + i) + cr);
+        }
+
+        if (i < n)
+        {
+            size_t count = n - i;
+            convert(LoadPartial(p + i, count), y, cb, cr);
+
+            StorePartial(yRow + i, y, count);
+            StorePartial(cbRow + i, LoadPartial(cbRow + i, count) + cb, count);
+            StorePartial(crRow + i, LoadPartial(crRow + i, count) + cr, count);
+        }
+    }
+
+    /// Converts the given RGBA8 image to planar 8-bit Y'CbCr 4:2:0, BT.709 limited range, with each chroma sample the
+    /// average of its 2x2 block. (That's the centre-sited '420jpeg' layout, which is also Y4M's default.) Odd-sized
+    /// images replicate their last row or column. 'yuv' must hold YUV420Size() bytes.
+    void RGBAToYUV420(const uint32_t* image, int width, int height, uint8_t* yuv)
+    {
+        int cw = (width  + 1) / 2;
+        int ch = (height + 1) / 2;
+
+        uint8_t* yPlane = yuv;
+        uint8_t* uPlane = yPlane + size_t(width) * height;
+        uint8_t* vPlane = uPlane + size_t(cw) * ch;
+
+        std::vector<int32_t> yRow(width);
+        std::vector<float>   cbRow(2 * cw);
+        std::vector<float>   crRow(2 * cw);
+
+        for (int j = 0; j < ch; j++)
+        {
+            std::fill(cbRow.begin(), cbRow.end(), 0.0f);
+            std::fill(crRow.begin(), crRow.end(), 0.0f);
+
+            for (int k = 0; k < 2; k++)
+            {
+                int r = 2 * j + k < height ? 2 * j + k : height - 1;
+
+                YCbCrRow(image + size_t(r) * width, yRow.data(), cbRow.data(), crRow.data(), width);
+
+                if (r == 2 * j + k)
+                    for (int i = 0; i < width; i++)
+                        yPlane[size_t(r) * width + i] = uint8_t(yRow[i]);
+            }
+
+            if (width & 1)
+            {
+                cbRow[width] = cbRow[width - 1];
+                crRow[width] = crRow[width - 1];
+            }
+
+            uint8_t* uRow = uPlane + size_t(j) * cw;
+            uint8_t* vRow = vPlane + size_t(j) * cw;
+
+            for (int i = 0; i < cw; i++)
+            {
+                uRow[i] = uint8_t(128.5f + 0.25f * (cbRow[2 * i] + cbRow[2 * i + 1]));
+                vRow[i] = uint8_t(128.5f + 0.25f * (crRow[2 * i] + crRow[2 * i + 1]));
+            }
+        }
+    }
+
+    /// Writes the Y4M stream header for 4:2:0 frames of the given size
+    bool Y4MWriteHeader(FILE* out, int width, int height, float fps)
+    {
+        int rateNum = int(fps * 1000.0f + 0.5f);
+        int rateDen = 1000;
+
+        if (rateNum % 1000 == 0)
+        {
+            rateNum /= 1000;
+            rateDen = 1;
+        }
+
+        return fprintf(out, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, rateNum, rateDen) > 0;
+    }
+
+    /// Writes one frame of YUV420Size() bytes
+    bool Y4MWriteFrame(FILE* out, const uint8_t* yuv, size_t size)
+    {
+        return fputs("FRAME\n", out) >= 0 && fwrite(yuv, 1, size, out) == size;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Movies: a day cycle of one or more views, rendered as a pipeline. Workers
+// each own a SunSky, and render and convert whole frames, out of order, into a
+// ring of YUV frame buffers, with one sky update per frame feeding all views.
+// A writer thread passes completed frames on in order as a Y4M stream per
+// view, so rendering overlaps with encoding.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    const float kMinAutoLum    = 2000.0f;
+    const float kAutoLumTarget = 0.4f;
+
+    /// Returns the luminance weight that brings a sky with the given average luminance to kAutoLumTarget
+    float AutoLumScale(float avgLum)
+    {
+        // Once we get dark enough (sun below horizon), stop auto-scaling, so we don't snap to black
+        if (avgLum < kMinAutoLum)
+            avgLum = kMinAutoLum;
+
+        return kAutoLumTarget / avgLum;
+    }
+
+    typedef std::function<Vec3f(float time)> SunDirFunc;
+
+    struct MovieInfo
+    {
+        float startTime = 6.0f;     ///< Local time of first frame
+        float endTime   = 21.0f;    ///< Local time of last frame, if it falls on a step
+        float timeStep  = 0.1f;     ///< Hours between frames
+        float fps       = 60.0f;
+        bool  autoscale = false;    ///< Autoscale intensity per frame
+        bool  verbose   = false;
+
+        int NumFrames() const
+        {
+            if (timeStep <= 0.0f || endTime < startTime)
+                return 0;
+
+            return int(floorf((endTime - startTime) / timeStep + 1e-3f)) + 1;
+        }
+    };
+
+    /// Renders the frames described by 'movie' for each of the given views, as a Y4M stream per view to outs[],
+    /// across the threads of 'pool', plus a writer thread. Returns false if a write fails, in which case rendering
+    /// stops early.
+    bool SkyToMovie(TaskPool& pool, const SunSky& sunSky, const SunDirFunc& sunDirAt, int numViews, const View views[], const MapInfo& mi, const MovieInfo& movie, FILE* const outs[])
+    {
+        struct Frame
+        {
+            std::vector<std::vector<uint8_t>> yuv;  ///< per view
+            int   index = -1;       ///< Frame held, once rendered
+            float avgLum = 0.0f;
+            float weight = 0.0f;
+        };
+
+        int numWorkers = pool.NumThreads();
+        int numFrames  = movie.NumFrames();
+        int ringSize   = 2 * numWorkers;    // lets workers run ahead while the writer is blocked
+
+        // Every frame has the same directions, so find them once
+        std::vector<View> gridViews(views, views + numViews);
+
+        for (View& view : gridViews)
+            view.grid = FindDirGrid(pool, view);
+
+        std::vector<SunSky> skies(numWorkers, sunSky);
+        std::vector<Frame>  ring(ringSize);
+        std::vector<std::vector<uint32_t>> images(numWorkers);   // per-worker RGBA
+
+        size_t maxPixels = 0;
+
+        for (int k = 0; k < numViews; k++)
+            maxPixels = std::max(maxPixels, size_t(views[k].width) * views[k].height);
+
+        for (Frame& frame : ring)
+        {
+            frame.yuv.resize(numViews);
+
+            for (int k = 0; k < numViews; k++)
+                frame.yuv[k].resize(YUV420Size(views[k].width, views[k].height));
+        }
+
+        bool failed = false;
+
+        for (int k = 0; k < numViews; k++)
+            failed = !Y4MWriteHeader(outs[k], views[k].width, views[k].height, movie.fps) || failed;
+
+        std::mutex              mutex;
+        std::condition_variable renderedCV;
+        std::condition_variable writtenCV;
+
+        int  nextFrame  = 0;    // next frame to claim for rendering
+        int  numWritten = 0;
+
+        std::thread writer
+        (
+            [&]
+            {
+                for (int f = 0; f < numFrames && !failed; f++)
+                {
+                    Frame& frame = ring[f % ringSize];
+
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        renderedCV.wait(lock, [&] { return frame.index == f; });
+                    }
+
+                    if (movie.verbose && movie.autoscale)
+                    {
+                        printf("Average luminance: %g\n", frame.avgLum);
+                        printf("Autoscaling luminance by: %g\n", frame.weight);
+                    }
+
+                    bool success = true;
+
+                    for (int k = 0; k < numViews; k++)
+                        success = Y4MWriteFrame(outs[k], frame.yuv[k].data(), frame.yuv[k].size()) && success;
+
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        frame.index = -1;
+                        numWritten++;
+                        failed = !success;
+                    }
+
+                    writtenCV.notify_all();
+
+                    if (!success)
+                        break;
+                }
+            }
+        );
+
+        pool.Run(numWorkers,
+            [&](int worker)
+            {
+                SunSky& sky = skies[worker];
+                std::vector<uint32_t>& image = images[worker];
+
+                image.resize(maxPixels);
+
+                while (true)
+                {
+                    int f;
+
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        writtenCV.wait(lock, [&] { return failed || nextFrame >= numFrames || nextFrame < numWritten + ringSize; });
+
+                        if (failed || nextFrame >= numFrames)
+                            return;
+
+                        f = nextFrame++;
+                    }
+
+                    Frame& frame = ring[f % ringSize];
+
+                    sky.SetSunDir(sunDirAt(movie.startTime + f * movie.timeStep));
+                    sky.Update();
+
+                    MapInfo frameInfo = mi;
+
+                    if (movie.autoscale)
+                    {
+                        frame.avgLum = sky.AverageLuminance();
+                        frameInfo.weight = AutoLumScale(frame.avgLum);
+                    }
+
+                    frame.weight = frameInfo.weight;
+
+                    LDREncoder encoder(frameInfo);
+
+                    for (int k = 0; k < numViews; k++)
+                    {
+                        const View& view = gridViews[k];
+
+                        SkyRows(sky, view, encoder, frameInfo.weight, 0, view.height, image.data(), nullptr, nullptr);
+                        RGBAToYUV420(image.data(), view.width, view.height, frame.yuv[k].data());
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        frame.index = f;
+                    }
+
+                    renderedCV.notify_one();
+                }
+            }
+        );
+
+        writer.join();
+
+        return !failed;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Hosek grid: precomputed Hosek coefficients, which reduce the per-frame sky
+// update to a table fetch. See SkyHosekGrid.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    /// Loads the grid for the given Hosek variant from 'path', or, if the file is missing or for the other variant,
+    /// builds it and saves it there. Returns false if the grid couldn't be saved, though it is still usable.
+    bool FindHosekGrid(SkyHosekGrid& grid, const char* path, bool cubic, bool verbose)
+    {
+        if (grid.Load(path))
+        {
+            if (grid.Cubic() == cubic)
+            {
+                if (verbose)
+                    printf("Loaded Hosek grid from %s\n", path);
+
+                return true;
+            }
+
+            fprintf(stderr, "Warning: %s holds the %s Hosek grid, replacing it with the %s one\n", path,
+                grid.Cubic() ? "cubic" : "full", cubic ? "cubic" : "full");
+        }
+
+        grid.Build(cubic);
+
+        if (!grid.Save(path))
+        {
+            fprintf(stderr, "Couldn't write Hosek grid to %s\n", path);
+            return false;
+        }
+
+        if (verbose)
+            printf("Wrote Hosek grid to %s (%zu bytes)\n", path, grid.Size());
+
+        return true;
+    }
+
+    /// Prints the error of the grid against the direct model, for sun elevations, turbidities and albedos falling
+    /// between grid samples. Errors are of sky luminance over the hemisphere, relative to the sky's peak.
+    void ReportHosekGridAccuracy(const SkyHosekGrid& grid)
+    {
+        const int kNumSkies = 4096;
+        const int kNumDirs  = 256;
+
+        float  maxError = 0.0f;
+        double sumError = 0.0;
+        int    numSkipped = 0;
+
+        SkyHosek direct;
+        SkyHosek fetched;
+
+        direct .mUseCubic = grid.Cubic();
+        fetched.mUseCubic = grid.Cubic();
+        fetched.mGrid     = &grid;
+
+        std::vector<float> lum(kNumDirs);
+
+        for (int i = 0; i < kNumSkies; i++)
+        {
+            // Low-discrepancy settings, via the fractional parts of multiples of irrationals
+            float u0 = fmodf(i * 0.6180340f, 1.0f);
+            float u1 = fmodf(i * 0.4142136f, 1.0f);
+            float u2 = fmodf(i * 0.7320508f, 1.0f);
+
+            float elevation = vlf_halfPi * (i + 0.5f) / kNumSkies;
+            Vec3f sun(cosf(elevation), 0.0f, sinf(elevation));
+            float turbidity = 1.0f + 9.0f * u0;
+            Vec3f albedo(u1, u2, 1.0f - u1);
+
+            direct .Update(sun, turbidity, albedo);
+            fetched.Update(sun, turbidity, albedo);
+
+            // Right at the horizon, the fitted radiance can pass through zero, which makes relative error meaningless
+            if (direct.mRadXYZ.y <= 0.0f)
+            {
+                numSkipped++;
+                continue;
+            }
+
+            float peak = 0.0f;
+
+            for (int j = 0; j < kNumDirs; j++)
+            {
+                float z   = (j + 0.5f) / kNumDirs;
+                float phi = j * 2.3999632f;     // golden angle
+                float r   = sqrtf(1.0f - z * z);
+                Vec3f v(r * cosf(phi), r * sinf(phi), z);
+
+                lum[j] = direct.SkyLuminance(v);
+                peak = std::max(peak, fabsf(lum[j]));
+
+                lum[j] -= fetched.SkyLuminance(v);
+            }
+
+            for (int j = 0; j < kNumDirs; j++)
+            {
+                float error = fabsf(lum[j]) / peak;
+
+                maxError = std::max(maxError, error);
+                sumError += error;
+            }
+        }
+
+        printf("Hosek grid error vs. direct, relative to peak sky luminance: max %.3g%%, mean %.3g%% (%d of %d skies skipped, with radiance <= 0)\n",
+            100.0f * maxError, 100.0 * sumError / (double(kNumSkies - numSkipped) * kNumDirs), numSkipped, kNumSkies);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Job files: many renders from one invocation. Each line of a CSV file gives
+// a job's settings, under the column names given by the first line, with
+// anything missing taken from the command line. Numeric fields can also be a
+// sweep, "start:end:count", with the job repeated for each value. Jobs are
+// grouped by sky state, so each state is updated once, and identical renders
+// are done once, with all of a state's renders done together.
+//------------------------------------------------------------------------------
+
+namespace
+{
+    struct EnumInfo
+    {
+        const char* mName;
+        const char* mShort;
+        int         mValue;
+    };
+
+    EnumInfo kSkyTypeEnum[] =
+    {
+        { "Preetham",         "pt",   kPreetham        },
+        { "PreethamTable",    "ptt",  kPreethamTable   },
+        { "PreethamBRDF",     "ptb",  kPreethamBRDF    },
+        { "Hosek",            "hk",   kHosek           },
+        { "HosekTable",       "hkt",  kHosekTable      },
+        { "HosekBRDF",        "hkb",  kHosekBRDF       },
+        { "HosekCubic",       "hc",   kHosekCubic      },
+        { "HosekCubicTable",  "hct",  kHosekCubicTable },
+        { "HosekCubicBRDF",   "hcb",  kHosekCubicBRDF  },
+        { "cieClear",         "cc",   kCIEClear        },
+        { "cieOvercast",      "co",   kCIEOvercast     },
+        { "ciePartlyCloudy",  "cp",   kCIEPartlyCloudy },
+        { "cieStandard1",     "cs1",  kCIEStandard1    },
+        { "cieStandard2",     "cs2",  kCIEStandard2    },
+        { "cieStandard3",     "cs3",  kCIEStandard3    },
+        { "cieStandard4",     "cs4",  kCIEStandard4    },
+        { "cieStandard5",     "cs5",  kCIEStandard5    },
+        { "cieStandard6",     "cs6",  kCIEStandard6    },
+        { "cieStandard7",     "cs7",  kCIEStandard7    },
+        { "cieStandard8",     "cs8",  kCIEStandard8    },
+        { "cieStandard9",     "cs9",  kCIEStandard9    },
+        { "cieStandard10",    "cs10", kCIEStandard10   },
+        { "cieStandard11",    "cs11", kCIEStandard11   },
+        { "cieStandard12",    "cs12", kCIEStandard12   },
+        { "cieStandard13",    "cs13", kCIEStandard13   },
+        { "cieStandard14",    "cs14", kCIEStandard14   },
+        { "cieStandard15",    "cs15", kCIEStandard15   },
+        { nullptr, nullptr, 0 }
+    };
+
+    EnumInfo kToneMapTypeEnum[] =
+    {
+        { "linear",       "l",   kToneMapLinear      },
+        { "exponential",  "ex",  kToneMapExponential },
+        { "reinhard",     "rh",  kToneMapReinhard    },
+        { nullptr, nullptr, 0 }
+    };
+
+    int ArgEnum(const EnumInfo info[], const char* name, int defaultValue = -1)
+    {
+        for ( ; info->mName; info++)
+            if (strcasecmp(info->mName, name) == 0 || strcasecmp(info->mShort, name) == 0)
+            {
+                return info->mValue;
+                break;
+            }
+
+        return defaultValue;
+    }
+
+    /// Returns the output weight to use for the given sky type if none is specified
+    float DefaultWeight(tSkyType skyType)
+    {
+        if (kHosek <= skyType && skyType <= kHosekCubicBRDF)
+            return 8e-5f;
+
+        return 5e-5f;
+    }
+
+    inline bool IsBRDF(tSkyType skyType)
+    {
+        return skyType == kPreethamBRDF || skyType == kHosekBRDF || skyType == kHosekCubicBRDF;
+    }
+
+    enum tJobColumn
+    {
+        kColumnSky,
+        kColumnTime,
+        kColumnDay,
+        kColumnLatitude,
+        kColumnLongitude,
+        kColumnTurbidity,
+        kColumnAlbedo,
+        kColumnOvercast,
+        kColumnRoughness,
+        kColumnProjection,
+        kColumnSize,
+        kColumnOutput,
+        kNumJobColumns
+    };
+
+    // Short names are the corresponding command-line options where there are any
+    EnumInfo kJobColumnEnum[] =
+    {
+        { "sky",          "s",    kColumnSky        },
+        { "time",         "t",    kColumnTime       },
+        { "day",          "d",    kColumnDay        },
+        { "latitude",     "lat",  kColumnLatitude   },
+        { "longitude",    "long", kColumnLongitude  },
+        { "turbidity",    "b",    kColumnTurbidity  },
+        { "albedo",       "x",    kColumnAlbedo     },
+        { "overcast",     "o",    kColumnOvercast   },
+        { "roughness",    "r",    kColumnRoughness  },
+        { "projection",   "p",    kColumnProjection },
+        { "size",         "n",    kColumnSize       },
+        { "output",       "out",  kColumnOutput     },
+        { nullptr, nullptr, 0 }
+    };
+
+    enum tJobProjection
+    {
+        kJobHemisphere,     // as set by -i and -f
+        kJobFisheye,
+        kJobCube,
+        kJobPanorama,
+        kNumJobProjections
+    };
+
+    EnumInfo kJobProjectionEnum[] =
+    {
+        { "hemisphere",   "hemi", kJobHemisphere },
+        { "fisheye",      "fish", kJobFisheye    },
+        { "cube",         "c",    kJobCube       },
+        { "panorama",     "pano", kJobPanorama   },
+        { nullptr, nullptr, 0 }
+    };
+
+    enum tJobOutputs
+    {
+        kJobPNG = 1,
+        kJobPFM = 2
+    };
+
+    struct Job
+    {
+        tSkyType        skyType;
+        float           time;
+        int             day;
+        Vec2f           latLong;
+        float           turbidity;
+        Vec3f           albedo;
+        float           overcast;
+        float           roughness;
+        tJobProjection  projection;
+        int             width;      ///< 0 = default for the projection
+        int             height;
+        std::string     output;     ///< file name, without extension
+        int             outputs;    ///< tJobOutputs: a .png or .pfm name gives just that, otherwise both
+    };
+
+    /// Sets the given numeric setting of 'job', returning false if it can't be swept
+    bool SetJobValue(Job* job, int column, float value)
+    {
+        switch (column)
+        {
+        case kColumnTime:       job->time       = value;                break;
+        case kColumnDay:        job->day        = int(lrintf(value));   break;
+        case kColumnLatitude:   job->latLong[0] = value;                break;
+        case kColumnLongitude:  job->latLong[1] = value;                break;
+        case kColumnTurbidity:  job->turbidity  = value;                break;
+        case kColumnAlbedo:     job->albedo     = Vec3f(value);         break;
+        case kColumnOvercast:   job->overcast   = value;                break;
+        case kColumnRoughness:  job->roughness  = value;                break;
+        default:
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Everything the sky depends on, for sharing updates between jobs
+    struct SkyState
+    {
+        tSkyType    skyType;
+        float       params[9];  ///< sun direction, turbidity, albedo, overcast, roughness
+
+        SkyState(const Job& job, const Vec3f& sunDir) :
+            skyType(job.skyType),
+            params
+            {
+                sunDir.x, sunDir.y, sunDir.z,
+                job.turbidity,
+                job.albedo.x, job.albedo.y, job.albedo.z,
+                job.overcast,
+                IsBRDF(job.skyType) ? job.roughness : 0.0f
+            }
+        {}
+
+        bool operator<(const SkyState& s) const
+        {
+            if (skyType != s.skyType)
+                return skyType < s.skyType;
+            return std::lexicographical_compare(params, params + 9, s.params, s.params + 9);
+        }
+    };
+
+    std::string Trim(const std::string& s)
+    {
+        size_t begin = s.find_first_not_of(" \t\r\n");
+
+        if (begin == std::string::npos)
+            return std::string();
+
+        return s.substr(begin, s.find_last_not_of(" \t\r\n") - begin + 1);
+    }
+
+    /// Splits a line of a job file into its comma-separated fields
+    std::vector<std::string> SplitFields(const std::string& line)
+    {
+        std::vector<std::string> fields;
+        size_t begin = 0;
+
+        while (true)
+        {
+            size_t end = line.find(',', begin);
+
+            if (end == std::string::npos)
+            {
+                fields.push_back(Trim(line.substr(begin)));
+                return fields;
+            }
+
+            fields.push_back(Trim(line.substr(begin, end - begin)));
+            begin = end + 1;
+        }
+    }
+
+    /// Parses either a single number or a sweep "start:end:count" into values. Returns false on a parse error.
+    bool ParseSweep(const std::string& field, std::vector<float>* values)
+    {
+        float start, end;
+        int   count;
+        char  extra;
+
+        values->clear();
+
+        if (sscanf(field.c_str(), "%f:%f:%d %c", &start, &end, &count, &extra) == 3 && count > 0)
+        {
+            for (int i = 0; i < count; i++)
+                values->push_back(count > 1 ? start + (end - start) * i / (count - 1) : start);
+
+            return true;
+        }
+
+        if (sscanf(field.c_str(), "%f %c", &start, &extra) == 1)
+        {
+            values->push_back(start);
+            return true;
+        }
+
+        return false;
+    }
+
+    /// Parses one line of fields into 'job', with any sweeps to 'sweeps', indexed by column. Returns false, having
+    /// reported the problem, on an error.
+    bool ParseJob(const std::vector<std::string>& fields, const std::vector<int>& columns, Job* job, std::vector<float> sweeps[], const char* fileName, int lineNumber)
+    {
+        if (fields.size() > columns.size())
+        {
+            fprintf(stderr, "%s:%d: too many fields\n", fileName, lineNumber);
+            return false;
+        }
+
+        for (size_t f = 0; f < fields.size(); f++)
+        {
+            const std::string& field = fields[f];
+            int  column  = columns[f];
+            bool success = true;
+
+            if (field.empty())
+                continue;
+
+            switch (column)
+            {
+            case kColumnSky:
+                job->skyType = (tSkyType) ArgEnum(kSkyTypeEnum, field.c_str(), kNumSkyTypes);
+                success = job->skyType != kNumSkyTypes;
+                break;
+
+            case kColumnProjection:
+                job->projection = (tJobProjection) ArgEnum(kJobProjectionEnum, field.c_str(), kNumJobProjections);
+                success = job->projection != kNumJobProjections;
+                break;
+
+            case kColumnSize:
+                job->height = 0;
+                success = sscanf(field.c_str(), "%d %d", &job->width, &job->height) >= 1 && job->width > 0 && job->height >= 0;
+                break;
+
+            case kColumnOutput:
+                {
+                    std::string extension = field.size() > 4 ? field.substr(field.size() - 4) : "";
+
+                    job->outputs = strcasecmp(extension.c_str(), ".png") == 0 ? kJobPNG
+                                 : strcasecmp(extension.c_str(), ".pfm") == 0 ? kJobPFM
+                                 : kJobPNG | kJobPFM;
+                    job->output  = job->outputs == (kJobPNG | kJobPFM) ? field : field.substr(0, field.size() - 4);
+                }
+                break;
+
+            case kColumnAlbedo:
+                // Either "r g b", or grey, which can be swept
+                if (sscanf(field.c_str(), "%f %f %f", &job->albedo.x, &job->albedo.y, &job->albedo.z) == 3)
+                    break;
+                // fall through
+
+            default:
+                success = ParseSweep(field, &sweeps[column]);
+            }
+
+            if (!success)
+            {
+                fprintf(stderr, "%s:%d: bad %s: %s\n", fileName, lineNumber, kJobColumnEnum[column].mName, field.c_str());
+                return false;
+            }
+        }
+
+        if (job->output.empty())
+        {
+            fprintf(stderr, "%s:%d: no output given\n", fileName, lineNumber);
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Reads the jobs from the given file, with settings it doesn't give taken from 'defaults'. Sweeps are expanded
+    /// into a job per combination of values, numbered from 1 via a %d in the output name. Returns false, having
+    /// reported the problem, on an error.
+    bool ReadJobs(const char* fileName, const Job& defaults, std::vector<Job>* jobs)
+    {
+        FILE* file = fopen(fileName, "r");
+
+        if (!file)
+        {
+            perror(fileName);
+            return false;
+        }
+
+        std::vector<int> columns;
+        std::map<std::string, int> outputLines;    ///< for reporting duplicate output names
+        std::string line;
+        char buffer[1024];
+        int  lineNumber = 0;
+        bool success = true;
+
+        while (success && fgets(buffer, sizeof(buffer), file))
+        {
+            line += buffer;
+
+            if (line.back() != '\n' && !feof(file))
+                continue;
+
+            lineNumber++;
+
+            std::vector<std::string> fields = SplitFields(line);
+            line.clear();
+
+            if ((fields.size() == 1 && fields[0].empty()) || fields[0][0] == '#')
+                continue;
+
+            // The first line names the columns
+            if (columns.empty())
+            {
+                for (const std::string& field : fields)
+                {
+                    columns.push_back(ArgEnum(kJobColumnEnum, field.c_str()));
+
+                    if (columns.back() < 0)
+                    {
+                        fprintf(stderr, "%s:%d: unknown column %s\n", fileName, lineNumber, field.c_str());
+                        success = false;
+                    }
+                }
+
+                continue;
+            }
+
+            Job job = defaults;
+            std::vector<float> sweeps[kNumJobColumns];
+
+            success = ParseJob(fields, columns, &job, sweeps, fileName, lineNumber);
+
+            if (!success)
+                break;
+
+            int count = 1;
+
+            for (const std::vector<float>& sweep : sweeps)
+                count *= sweep.empty() ? 1 : int(sweep.size());
+
+            size_t index = job.output.find("%d");
+
+            if (count > 1 && index == std::string::npos)
+            {
+                fprintf(stderr, "%s:%d: sweeps need a %%d in the output name\n", fileName, lineNumber);
+                success = false;
+                break;
+            }
+
+            for (int n = 0; n < count; n++)
+            {
+                Job sweepJob = job;
+
+                for (int c = 0, rest = n; c < kNumJobColumns; c++)
+                    if (!sweeps[c].empty())
+                    {
+                        int size = int(sweeps[c].size());
+
+                        SetJobValue(&sweepJob, c, sweeps[c][rest % size]);
+                        rest /= size;
+                    }
+
+                if (index != std::string::npos)
+                    sweepJob.output.replace(index, 2, std::to_string(n + 1));
+
+                auto inserted = outputLines.insert({ sweepJob.output, lineNumber });
+
+                if (!inserted.second)
+                    fprintf(stderr, "%s:%d: warning: output %s is also written by line %d\n", fileName, lineNumber, sweepJob.output.c_str(), inserted.first->second);
+
+                jobs->push_back(sweepJob);
+            }
+        }
+
+        fclose(file);
+        return success;
+    }
+
+    /// Returns true if 'a' and 'b' name the same existing file
+    bool SameFile(const std::string& a, const std::string& b)
+    {
+        if (a == b)
+            return true;
+
+    #ifndef _MSC_VER
+        struct stat statA, statB;
+
+        if (stat(a.c_str(), &statA) == 0 && stat(b.c_str(), &statB) == 0)
+            return statA.st_dev == statB.st_dev && statA.st_ino == statB.st_ino;
+    #endif
+
+        return false;
+    }
+
+    /// Copies file 'from' to 'to', and reports the result. Copying a file onto itself does nothing.
+    bool CopyFile(const std::string& from, const std::string& to)
+    {
+        if (SameFile(from, to))     // opening 'to' would truncate 'from'
+            return true;
+
+        FILE* in  = fopen(from.c_str(), "rb");
+        FILE* out = in ? fopen(to.c_str(), "wb") : nullptr;
+
+        bool   success = out != nullptr;
+        char   buffer[64 * 1024];
+        size_t count;
+
+        while (success && (count = fread(buffer, 1, sizeof(buffer), in)) > 0)
+            success = fwrite(buffer, 1, count, out) == count;
+
+        if (in)
+            success = !ferror(in) && success;
+        if (in)
+            fclose(in);
+        if (out)
+            success = fclose(out) == 0 && success;
+
+        ReportWrite(to.c_str(), success);
+        return success;
+    }
+
+    /// Runs the jobs in the given file, with settings it doesn't give taken from 'defaults', and output mapping from
+    /// 'mi'. Batches of sky states are updated in parallel, and then each state's renders are done together, across
+    /// the threads of 'pool'. If 'gridFile' is set, Hosek skies use the grid found there, for the variant of the first
+    /// Hosek job. Returns false if any job fails.
+    bool RunJobs(TaskPool& pool, const char* fileName, const Job& defaults, bool dst, const MapInfo& mi, const char* gridFile, bool autoscale, bool verbose)
+    {
+        std::vector<Job> jobs;
+
+        if (!ReadJobs(fileName, defaults, &jobs))
+            return false;
+
+        SkyHosekGrid hosekGrid;
+
+        if (gridFile)
+        {
+            int numHosek[2] = { 0, 0 };     // full, cubic
+            int firstHosek = -1;
+
+            for (const Job& job : jobs)
+                if (kHosek <= job.skyType && job.skyType <= kHosekCubicBRDF)
+                {
+                    bool cubic = job.skyType >= kHosekCubic;
+
+                    if (firstHosek < 0)
+                        firstHosek = cubic;
+
+                    numHosek[cubic]++;
+                }
+
+            if (firstHosek >= 0)
+            {
+                FindHosekGrid(hosekGrid, gridFile, firstHosek != 0, verbose);
+
+                if (numHosek[!firstHosek] > 0)
+                    fprintf(stderr, "Warning: %d %s Hosek jobs don't match the grid, and won't use it\n", numHosek[!firstHosek], firstHosek ? "full" : "cubic");
+
+                if (verbose)
+                    ReportHosekGridAccuracy(hosekGrid);
+            }
+        }
+
+        // Jobs that would produce identical files share a render
+        struct Render
+        {
+            tJobProjection   projection;
+            int              width;
+            int              height;
+            int              outputs;
+            std::vector<int> jobs;  ///< the first names the rendered files, the rest get copies
+
+            bool Matches(const Job& job) const
+            {
+                return projection == job.projection && width == job.width && height == job.height && outputs == job.outputs;
+            }
+        };
 
-                faceDir = norm(faceDir);
+        struct State
+        {
+            Vec3f               sunDir;
+            int                 job;        ///< for the sky settings
+            std::vector<Render> renders;
+        };
 
-                row[j] = sunSky.SkyRGB(faceDir) * mi.weight;
-            }
+        std::map<SkyState, int> stateIndices;
+        std::vector<State>      states;
+        int numRenders = 0;
 
-            data -= stride;
-        }
-    }
-}
+        for (int j = 0; j < int(jobs.size()); j++)
+        {
+            const Job& job = jobs[j];
 
+            float timeZone = rintf(job.latLong[1] / 15.0f) + (dst ? 1.0f : 0.0f);   // as for the command line
+            Vec3f sunDir = SunDirection(job.time, timeZone, job.day, job.latLong[0], job.latLong[1]);
 
-//------------------------------------------------------------------------------
-// Panorama generation in LDR (png) and HDR (pfm)
-//------------------------------------------------------------------------------
+            auto inserted = stateIndices.insert({ SkyState(job, sunDir), int(states.size()) });
 
-namespace
-{
-    void SkyToPanoramic(const SunSky& sunSky, int height, uint8_t* data, int stride, const MapInfo& mi)
-    {
-        float invGamma = 1.0;
+            if (inserted.second)
+                states.push_back({ sunDir, j, {} });
 
-        if (mi.gamma > 0.0)
-            invGamma = 1.0f / mi.gamma;
+            std::vector<Render>& renders = states[inserted.first->second].renders;
 
-        int width = 2 * height;
-        if (stride == 0)
-            stride = 4 * width;
+            auto it = std::find_if(renders.begin(), renders.end(), [&](const Render& render) { return render.Matches(job); });
 
-        float da = vl_pi / height;
-        float phi = vl_pi - 0.5f * da;
+            if (it == renders.end())
+            {
+                renders.push_back({ job.projection, job.width, job.height, job.outputs, {} });
+                it = renders.end() - 1;
+                numRenders++;
+            }
 
-        data += (height - 1) * stride;
+            it->jobs.push_back(j);
+        }
 
-        for (int i = 0; i < height; i++)
+        int numStates = int(states.size());
+
+        if (verbose)
+            printf("Jobs: %zu, sky states: %d, renders: %d\n", jobs.size(), numStates, numRenders);
+
+        int batchSize = pool.NumThreads();
+        std::vector<SunSky> skies(batchSize);
+        bool success = true;
+
+        for (int firstState = 0; firstState < numStates; firstState += batchSize)
         {
-            uint32_t* row = (uint32_t*) data;
+            int count = std::min(batchSize, numStates - firstState);
 
-            float theta = 0.5f * da;
-            float sp = sinf(phi);
-            float cp = cosf(phi);
+            pool.Run(count,
+                [&](int k)
+                {
+                    const State& state = states[firstState + k];
+                    const Job&   job   = jobs[state.job];
+                    SunSky&      sky   = skies[k];
+
+                    sky.SetSkyType  (job.skyType);
+                    sky.SetHosekGrid(hosekGrid.Valid() ? &hosekGrid : nullptr);
+                    sky.SetSunDir   (state.sunDir);
+                    sky.SetTurbidity(job.turbidity);
+                    sky.SetAlbedo   (job.albedo);
+                    sky.SetOvercast (job.overcast);
+                    sky.SetRoughness(job.roughness);
+                    sky.Update();
+                }
+            );
 
-            for (int j = 0; j < width; j++)
+            for (int k = 0; k < count; k++)
             {
-                float st = sinf(theta);
-                float ct = cosf(theta);
+                const SunSky& sky = skies[k];
+                const State& state = states[firstState + k];
 
-                // middle of image is north, east to right, west to left, edges are south
-                Vec3f dir(-st * sp, -ct * sp, cp);
+                MapInfo stateInfo = mi;
 
-                Vec3f c = sunSky.SkyRGB(dir);
+                if (stateInfo.weight < 0.0f)
+                    stateInfo.weight = DefaultWeight(sky.SkyType());
+                if (autoscale)
+                    stateInfo.weight = AutoLumScale(sky.AverageLuminance());
 
-                c = mi.toneMap(c, mi.weight);
-                c = pow(c, invGamma);
+                // Gather all the state's views, with their file names minus extensions, and suffixes for cube faces
+                std::vector<View>        views;
+                std::vector<const Render*> viewRenders;
+                std::vector<std::string> suffixes;
 
-                row[j] = RGBFToU32(c);
-                theta += da;
-            }
+                for (const Render& render : state.renders)
+                {
+                    int width  = render.width  != 0 ? render.width  : render.projection == kJobPanorama ? 512       : 256;
+                    int height = render.height != 0 ? render.height : render.projection == kJobPanorama ? width / 2 : width;
+
+                    MapInfo viewInfo = stateInfo;
+
+                    switch (render.projection)
+                    {
+                    case kJobFisheye:
+                        viewInfo.fisheye = true;
+                        // fall through
+                    case kJobHemisphere:
+                        views.push_back(HemisphereView(width, height, viewInfo));
+                        suffixes.push_back("");
+                        break;
+
+                    case kJobCube:
+                        for (int i = 0; i < 6; i++)
+                        {
+                            views.push_back(CubeFaceView(i, width, height));
+                            suffixes.push_back("-" + std::to_string(i));
+                        }
+                        break;
+
+                    default:
+                        views.push_back(PanoramicView(width, height));
+                        suffixes.push_back("");
+                    }
+
+                    viewRenders.resize(views.size(), &render);
+                }
 
-            data -= stride;
-            phi -= da;
-        }
-    }
+                int numViews = int(views.size());
 
-    void SkyToPanoramic(const SunSky& sunSky, int height, Vec3f* data, const MapInfo& mi)
-    {
-        int width = 2 * height;
-        int stride = width;
+                std::vector<std::string> fileNamesPNG(numViews);
+                std::vector<std::string> fileNamesPFM(numViews);
+                std::vector<const char*> namesPNG(numViews, nullptr);
+                std::vector<const char*> namesPFM(numViews, nullptr);
 
-        float da = vl_pi / height;
-        float phi = vl_pi - 0.5f * da;
+                for (int v = 0; v < numViews; v++)
+                {
+                    const Render& render = *viewRenders[v];
+                    std::string base = jobs[render.jobs[0]].output + suffixes[v];
 
-        data += (height - 1) * stride;
+                    fileNamesPNG[v] = base + ".png";
+                    fileNamesPFM[v] = base + ".pfm";
 
-        for (int i = 0; i < height; i++)
-        {
-            Vec3f* row = data;
+                    if (render.outputs & kJobPNG)
+                        namesPNG[v] = fileNamesPNG[v].c_str();
+                    if (render.outputs & kJobPFM)
+                        namesPFM[v] = fileNamesPFM[v].c_str();
+                }
 
-            float theta = 0.5f * da;
-            float sp = sinf(phi);
-            float cp = cosf(phi);
+                success = SkyToFiles(pool, sky, numViews, views.data(), namesPNG.data(), namesPFM.data(), stateInfo, nullptr) && success;
 
-            for (int j = 0; j < width; j++)
-            {
-                float st = sinf(theta);
-                float ct = cosf(theta);
+                for (int v = 0; v < numViews; v++)
+                {
+                    const Render& render = *viewRenders[v];
 
-                // middle of image is north, east to right, west to left, edges are south
-                Vec3f dir(-st * sp, -ct * sp, cp);
+                    for (size_t d = 1; d < render.jobs.size(); d++)
+                    {
+                        std::string base = jobs[render.jobs[d]].output + suffixes[v];
 
-                row[j] = sunSky.SkyRGB(dir) * mi.weight;
-                theta += da;
-            }
+                        if (base == jobs[render.jobs[0]].output + suffixes[v])
+                            continue;   // duplicate output name, already rendered
 
-            data -= stride;
-            phi -= da;
+                        if (render.outputs & kJobPNG)
+                            success = CopyFile(fileNamesPNG[v], base + ".png") && success;
+                        if (render.outputs & kJobPFM)
+                            success = CopyFile(fileNamesPFM[v], base + ".pfm") && success;
+                    }
+                }
+            }
         }
-    }
 
-    const float kMinAutoLum    = 2000.0f;
-    const float kAutoLumTarget = 0.4f;
+        return success;
+    }
 }
 
 
-
 //------------------------------------------------------------------------------
 // Main program
 //------------------------------------------------------------------------------
 
 namespace
 {
-    struct EnumInfo
-    {
-        const char* mName;
-        const char* mShort;
-        int         mValue;
-    };
-
-    EnumInfo kSkyTypeEnum[] =
+    void Mirror(TaskPool& pool, const SunSky& sunSky, int numViews, View views[], bool verbose)
     {
-        { "Preetham",         "pt",   kPreetham        },
-        { "PreethamTable",    "ptt",  kPreethamTable   },
-        { "PreethamBRDF",     "ptb",  kPreethamBRDF    },
-        { "Hosek",            "hk",   kHosek           },
-        { "HosekTable",       "hkt",  kHosekTable      },
-        { "HosekBRDF",        "hkb",  kHosekBRDF       },
-        { "HosekCubic",       "hc",   kHosekCubic      },
-        { "HosekCubicTable",  "hct",  kHosekCubicTable },
-        { "HosekCubicBRDF",   "hcb",  kHosekCubicBRDF  },
-        { "cieClear",         "cc",   kCIEClear        },
-        { "cieOvercast",      "co",   kCIEOvercast     },
-        { "ciePartlyCloudy",  "cp",   kCIEPartlyCloudy },
-        { nullptr, nullptr, 0 }
-    };
+        size_t evaluated = MirrorSky(pool, sunSky, numViews, views);
 
-    EnumInfo kToneMapTypeEnum[] =
-    {
-        { "linear",       "l",   kToneMapLinear      },
-        { "exponential",  "ex",  kToneMapExponential },
-        { "reinhard",     "rh",  kToneMapReinhard    },
-        { nullptr, nullptr, 0 }
-    };
+        if (verbose)
+        {
+            size_t total = 0;
 
-    int ArgEnum(const EnumInfo info[], const char* name, int defaultValue = -1)
-    {
-        for ( ; info->mName; info++)
-            if (strcasecmp(info->mName, name) == 0 || strcasecmp(info->mShort, name) == 0)
-            {
-                return info->mValue;
-                break;
-            }
+            for (int k = 0; k < numViews; k++)
+                for (int sw : views[k].sky->insets)
+                    total += views[k].width - 2 * sw;
 
-        return defaultValue;
+            printf("Mirroring evaluated %zu of %zu directions (%.1f%%)\n", evaluated, total, 100.0 * evaluated / total);
+        }
     }
 
     int Help(const char* command)
@@ -572,14 +3127,25 @@ namespace
             "  -r <roughness>     : 0 - 1, specify roughness for BRDF types\n"
             "  -l <latitude> <longitude>\n"
             "  -w <luminance scale>\n"
-            "  -g <gamma>\n"
+            "  -g <gamma>|srgb    : output gamma, or sRGB encoding (default: 2.2)\n"
             "  -e <tonemapType> : use given tonemap operator (default: linear)\n"
             "  -a : autoscale intensity\n"
             "  -i : invert hemisphere\n"
             "  -f : fisheye rather than cos projection\n"
-            "  -c : output cubemap instead\n"
-            "  -p : output panorama instead\n"
-            "  -m : output movie, record day as sky.mp4, requires ffmpeg\n"
+            "  -S : mirror the sky about the sun's vertical plane, evaluating about half the directions\n"
+            "  -c : output cubemap instead of hemisphere\n"
+            "  -p : output panorama instead of hemisphere\n"
+            "  -H : output hemisphere as well. -c, -p and -H combine, with all outputs sharing one sky update\n"
+            "  -J <jobs.csv>      : run the jobs in the given file, with the other options as defaults. See README.md\n"
+            "  -G <grid.bin>      : use a precomputed grid for Hosek sky updates, loaded from the given file, or built and saved there\n"
+            "  -z <count>         : output count panoramas, with the sun rotated evenly about the zenith between them\n"
+            "  -m : output movie, record day as sky.mp4 (and sky-cube-<n>.mp4, sky-panoramic.mp4), requires ffmpeg\n"
+            "  -Y <file.y4m>      : output movie as an uncompressed y4m file instead, without ffmpeg\n"
+            "  -T <start> <end> [<step>] : movie time range and step in hours (default: 6 21 0.1)\n"
+            "  -F <fps>           : movie frame rate (default: 60)\n"
+            "  -R : output roughness map instead, roughness 0 - 1 from left to right, for BRDF types\n"
+            "  -n <width> [<height>] : output size (default: 256 x 256, or 512 x 256 for panoramas)\n"
+            "  -j <threads>       : number of render threads (default: one per core)\n"
             "  -v : verbose\n"
             , command
         );
@@ -625,9 +3191,20 @@ int main(int argc, const char* argv[])
     float roughness = -1.0f;
     bool autoscale  = false;
     bool cubeMap    = false;
+    bool hemisphere = false;
     bool panoramic  = false;
+    int  numPanoramas = 1;
     bool movie      = false;
+    MovieInfo movieInfo;
+    const char* movieFile = nullptr;
+    bool roughMap   = false;
+    const char* jobFile = nullptr;
+    const char* gridFile = nullptr;
+    bool mirror     = false;
     bool verbose    = false;
+    int  numThreads = 0;
+    int  width      = 0;    // 0 = default for output type
+    int  height     = 0;
     tSkyType skyType = kPreetham;
 
     // Options
@@ -714,7 +3291,9 @@ int main(int argc, const char* argv[])
         case 'g':
             if (ArgCountError(option, 1, argc))
                 return -1;
-            mi.gamma = (float) atof(argv[0]);
+            mi.sRGB = strcasecmp(argv[0], "srgb") == 0;
+            if (!mi.sRGB)
+                mi.gamma = (float) atof(argv[0]);
             argv++; argc--;
             break;
 
@@ -727,15 +3306,43 @@ int main(int argc, const char* argv[])
         case 'p':
             panoramic = !panoramic;
             break;
+        case 'H':
+            hemisphere = !hemisphere;
+            break;
+        case 'J':
+            if (ArgCountError(option, 1, argc))
+                return -1;
+            jobFile = argv[0];
+            argv++; argc--;
+            break;
+        case 'G':
+            if (ArgCountError(option, 1, argc))
+                return -1;
+            gridFile = argv[0];
+            argv++; argc--;
+            break;
+        case 'z':
+            if (ArgCountError(option, 1, argc))
+                return -1;
+            numPanoramas = atoi(argv[0]);
+            panoramic = true;
+            argv++; argc--;
+            break;
         case 'm':
             movie = !movie;
             break;
+        case 'R':
+            roughMap = !roughMap;
+            break;
         case 'i':
             mi.hemiSign = -mi.hemiSign;
             break;
         case 'f':
             mi.fisheye = !mi.fisheye;
             break;
+        case 'S':
+            mirror = !mirror;
+            break;
         case 'v':
             verbose = !verbose;
             break;
@@ -766,9 +3373,9 @@ int main(int argc, const char* argv[])
                 const char* typeName = argv[0];
                 argv++; argc--;
 
-                mi.toneMap = kToneMapFuncs[ArgEnum(kToneMapTypeEnum, typeName, kNumToneMapTypes)];
+                mi.toneMap = (kToneMapType) ArgEnum(kToneMapTypeEnum, typeName, kNumToneMapTypes);
 
-                if (!mi.toneMap)
+                if (mi.toneMap == kNumToneMapTypes)
                 {
                     fprintf(stderr, "Unknown tone map type: %s\n", typeName);
                     return -1;
@@ -783,6 +3390,74 @@ int main(int argc, const char* argv[])
             argv++; argc--;
             break;
 
+        case 'n':
+            if (ArgCountError(option, 1, argc))
+                return -1;
+            width = atoi(argv[0]);
+            argv++; argc--;
+
+            if (argc >= 1 && argv[0][0] != '-')
+            {
+                height = atoi(argv[0]);
+                argv++; argc--;
+            }
+
+            if (width <= 0 || height < 0)
+            {
+                fprintf(stderr, "Invalid image size\n");
+                return -1;
+            }
+            break;
+
+        case 'j':
+            if (ArgCountError(option, 1, argc))
+                return -1;
+            numThreads = atoi(argv[0]);
+            argv++; argc--;
+            break;
+
+        case 'T':
+            if (ArgCountError(option, 2, argc))
+                return -1;
+            movieInfo.startTime = (float) atof(argv[0]);
+            argv++; argc--;
+            movieInfo.endTime = (float) atof(argv[0]);
+            argv++; argc--;
+
+            if (argc >= 1 && argv[0][0] != '-')
+            {
+                movieInfo.timeStep = (float) atof(argv[0]);
+                argv++; argc--;
+            }
+
+            if (movieInfo.NumFrames() == 0)
+            {
+                fprintf(stderr, "Invalid movie time range\n");
+                return -1;
+            }
+            break;
+
+        case 'Y':
+            if (ArgCountError(option, 1, argc))
+                return -1;
+            movieFile = argv[0];
+            argv++; argc--;
+            movie = true;
+            break;
+
+        case 'F':
+            if (ArgCountError(option, 1, argc))
+                return -1;
+            movieInfo.fps = (float) atof(argv[0]);
+            argv++; argc--;
+
+            if (movieInfo.fps <= 0.0f)
+            {
+                fprintf(stderr, "Invalid frame rate\n");
+                return -1;
+            }
+            break;
+
 
         default:
             fprintf(stderr, "Unrecognised option: %s\n", option);
@@ -796,6 +3471,28 @@ int main(int argc, const char* argv[])
         return -1;
     }
 
+    if (jobFile)
+    {
+        Job defaults;
+
+        defaults.skyType    = skyType;
+        defaults.time       = localTime;
+        defaults.day        = julianDay;
+        defaults.latLong    = latLong;
+        defaults.turbidity  = turbidity;
+        defaults.albedo     = albedo;
+        defaults.overcast   = overcast;
+        defaults.roughness  = roughness >= 0.0f ? roughness : 0.0f;
+        defaults.projection = panoramic ? kJobPanorama : cubeMap ? kJobCube : kJobHemisphere;
+        defaults.width      = width;
+        defaults.height     = height;
+        defaults.outputs    = kJobPNG | kJobPFM;
+
+        TaskPool pool(numThreads);
+
+        return RunJobs(pool, jobFile, defaults, dst, mi, gridFile, autoscale, verbose) ? 0 : -1;
+    }
+
     float timeZone = rintf(latLong[1] / 15.0f);    // estimate for now
 
     if (dst)
@@ -806,6 +3503,19 @@ int main(int argc, const char* argv[])
     SunSky sunSky;
     sunSky.SetSkyType(skyType);
 
+    SkyHosekGrid hosekGrid;
+
+    if (gridFile && kHosek <= skyType && skyType <= kHosekCubicBRDF)
+    {
+        bool cubic = skyType >= kHosekCubic;
+
+        FindHosekGrid(hosekGrid, gridFile, cubic, verbose);
+        sunSky.SetHosekGrid(&hosekGrid);
+
+        if (verbose)
+            ReportHosekGridAccuracy(hosekGrid);
+    }
+
     sunSky.SetSunDir(sunDir);
     sunSky.SetTurbidity(turbidity);
     sunSky.SetAlbedo(albedo);
@@ -816,9 +3526,12 @@ int main(int argc, const char* argv[])
 
     sunSky.Update();
 
+    TaskPool pool(numThreads);
+
     if (verbose)
     {
         printf("Time: %g, time zone: %g, day: %d, latitude: %g, longitude: %g, turbidity: %g, albedo: %g\n", localTime, timeZone, julianDay, latLong[0], latLong[1], turbidity, albedo.y);
+        printf("Batch ISA: %s, threads: %d\n", BatchISA(), pool.NumThreads());
 
         float theta = asinf (sunDir.z);
         float phi   = atan2f(sunDir.y, sunDir.x);
@@ -836,12 +3549,7 @@ int main(int argc, const char* argv[])
     }
 
     if (mi.weight < 0.0f)
-    {
-        if (kHosek <= skyType && skyType <= kHosekCubicBRDF)
-            mi.weight = 8e-5f;
-        else
-            mi.weight = 5e-5f;
-    }
+        mi.weight = DefaultWeight(skyType);
 
     if (!movie && autoscale)
     {
@@ -850,11 +3558,7 @@ int main(int argc, const char* argv[])
         if (verbose)
             printf("Average luminance: %g\n", avgLum);
 
-        // Once we get dark enough (sun below horizon), stop auto-scaling, so we don't snap to black
-        if (avgLum < kMinAutoLum)
-            avgLum = kMinAutoLum;
-
-        float lumScale = kAutoLumTarget / avgLum;
+        float lumScale = AutoLumScale(avgLum);
 
         if (verbose)
             printf("Autoscaling luminance by: %g\n", lumScale);
@@ -863,142 +3567,207 @@ int main(int argc, const char* argv[])
     }
 
     if (verbose)
-        printf("Ouput: weight = %g, gamma = %g\n", mi.weight, mi.gamma);
+    {
+        if (mi.sRGB)
+            printf("Ouput: weight = %g, sRGB\n", mi.weight);
+        else
+            printf("Ouput: weight = %g, gamma = %g\n", mi.weight, mi.gamma);
+    }
 
-    char fileName[32];
+    // Size defaults depend on the output type
+    int panoWidth  = width  != 0 ? width  : 512;
+    int panoHeight = height != 0 ? height : panoWidth / 2;
 
-    if (panoramic)
-    {
-        uint32_t image   [256][512];
-        Vec3f    imageHDR[256][512];
+    if (width == 0)
+        width = 256;
+    if (height == 0)
+        height = width;
 
-        SkyToPanoramic(sunSky, 256, (uint8_t*) image, 0, mi);
+    if (roughMap)
+    {
+        std::vector<uint32_t> image(size_t(width) * height);
 
-        snprintf(fileName, 32, "sky-panoramic.png");
+        clock_t start = clock();
+        int samples = SkyToRoughnessMap(sunSky, width, height, (uint8_t*) image.data(), 4 * width, mi);
+        double ms = 1000.0 * (clock() - start) / CLOCKS_PER_SEC;
 
-        if (stbi_write_png(fileName, 512, 256, 4, image[0], 0) != 0)
-            printf("wrote %s\n", fileName);
-        else
-            printf("failed to write %s\n", fileName);
+        if (verbose)
+            printf("Evaluated %d samples in %.3f ms (%.1f Msamples/s)\n", samples, ms, ms > 0.0 ? samples / (1000.0 * ms) : 0.0);
 
-        SkyToPanoramic(sunSky, 256, imageHDR[0], mi);
+        const char* fileName = "sky-roughness.png";
 
-        snprintf(fileName, 32, "sky-panoramic.pfm");
+        ReportWrite(fileName, stbi_write_png(fileName, width, height, 4, image.data(), 0) != 0);
 
-        if (PFMWrite(fileName, 512, 256, imageHDR[0]))
-            printf("wrote %s\n", fileName);
-        else
-            printf("failed to write %s\n", fileName);
+        return 0;
     }
-    else if (cubeMap)
+
+    if (numPanoramas > 1)
     {
-        uint32_t image   [256][256];
-        Vec3f    imageHDR[256][256];
+        // Only the first panorama is evaluated in full, the rest are shifted from the cached one
+        View view = PanoramicView(panoWidth, panoHeight);
 
-        for (int i = 0; i < 6; i++)
+        for (int n = 0; n < numPanoramas; n++)
         {
-            SkyToCubeFace(sunSky, i, 256, 256, (uint8_t*) image, 4 * 256, mi);
+            // Clockwise from above, as for compass headings
+            float angle = vl_twoPi * n / numPanoramas;
+            float c = cosf(angle);
+            float s = sinf(angle);
+
+            sunSky.SetSunDir(Vec3f(sunDir.x * c + sunDir.y * s, sunDir.y * c - sunDir.x * s, sunDir.z));
+            sunSky.Update();
 
-            snprintf(fileName, 32, "sky-cube-%d.png", i);
+            size_t evaluated;
+            view.sky = FindPanorama(pool, sunSky, view, mirror, &evaluated);
 
-            if (stbi_write_png(fileName, 256, 256, 4, image[0], 0) != 0)
-                printf("wrote %s\n", fileName);
-            else
-                printf("failed to write %s\n", fileName);
+            if (verbose)
+                printf("Panorama %d: evaluated %zu of %zu directions\n", n, evaluated, view.sky->colours.size());
 
-            SkyToCubeFace(sunSky, i, 256, 256, imageHDR[0], mi);
+            char fileNamePNG[32];
+            char fileNamePFM[32];
+            snprintf(fileNamePNG, 32, "sky-panoramic-%d.png", n);
+            snprintf(fileNamePFM, 32, "sky-panoramic-%d.pfm", n);
 
-            snprintf(fileName, 32, "sky-cube-%d.pfm", i);
+            const char* namePNG = fileNamePNG;
+            const char* namePFM = fileNamePFM;
 
-            if (PFMWrite(fileName, 256, 256, imageHDR[0]))
-                printf("wrote %s\n", fileName);
-            else
-                printf("failed to write %s\n", fileName);
+            SkyToFiles(pool, sunSky, 1, &view, &namePNG, &namePFM, mi, nullptr);
         }
+
+        return 0;
     }
-#ifndef _MSC_VER
-    else if (movie)
-    {
-        uint32_t image[256][256];
 
-        // crf = constant rate factor, 0 - 51, 0 is lossless, 51 worst
-        // -preset = veryfast/faster/fast/medium/slow/slower/veryslow
-        const char* cmd = "ffmpeg -r 60 -f rawvideo -pix_fmt rgba -s 256x256 -i - -threads 0 -preset medium -y -pix_fmt yuv420p -crf 10 sky.mp4";
+    // All requested outputs share the sky update above, and are rendered together
+    std::vector<View>        views;
+    std::vector<std::string> names;
 
-        // open pipe to ffmpeg's stdin in binary write mode
-        FILE* ffmpeg = popen(cmd, "w");
+    if (hemisphere || !(cubeMap || panoramic))
+    {
+        views.push_back(HemisphereView(width, height, mi));
+        names.push_back("sky-hemi");
+    }
 
-        if (!ffmpeg)
+    if (cubeMap)
+        for (int i = 0; i < 6; i++)
         {
-            perror("cmd");
-            return -1;
+            views.push_back(CubeFaceView(i, width, height));
+            names.push_back("sky-cube-" + std::to_string(i));
         }
 
-        for (float time = 6.0f; time <= 21.0f; time += 0.1f)
+    if (panoramic)
+    {
+        views.push_back(PanoramicView(panoWidth, panoHeight));
+        names.push_back("sky-panoramic");
+    }
+
+    int numViews = int(views.size());
+
+    if (movie)
+    {
+        movieInfo.autoscale = autoscale;
+        movieInfo.verbose   = verbose;
+
+        // The hemisphere movie keeps its original name, others are suffixed by the view, e.g., sky-panoramic.mp4
+        std::vector<std::string> outNames(numViews);
+        std::vector<FILE*>       outs(numViews, nullptr);
+        bool success = true;
+
+        for (int k = 0; k < numViews; k++)
         {
-            sunSky.SetSunDir(SunDirection(time, timeZone, julianDay, latLong[0], latLong[1]));
-            sunSky.Update();
+            std::string suffix = views[k].key.projection == kProjectionHemisphere ? "" : names[k].substr(3);
 
-            if (autoscale)
+            if (movieFile)
             {
-                float avgLum = sunSky.AverageLuminance();
+                std::string base  = movieFile;
+                size_t      dot   = base.find_last_of('.');
+                size_t      slash = base.find_last_of("/\\");
 
-                if (verbose)
-                    printf("Average luminance: %g\n", avgLum);
+                if (dot == std::string::npos || (slash != std::string::npos && slash > dot))
+                    dot = base.size();
 
-                // Once we get dark enough (sun below horizon), stop auto-scaling, so we don't snap to black
-                if (avgLum < kMinAutoLum)
-                    avgLum = kMinAutoLum;
+                outNames[k] = base.substr(0, dot) + suffix + base.substr(dot);
+                outs[k] = fopen(outNames[k].c_str(), "wb");
+            }
+        #ifndef _MSC_VER
+            else
+            {
+                outNames[k] = "sky" + suffix + ".mp4";
 
-                float lumScale = kAutoLumTarget / avgLum;
+                // Frames arrive as BT.709 yuv420p already, so ffmpeg only has to encode them.
+                // crf = constant rate factor, 0 - 51, 0 is lossless, 51 worst
+                // -preset = veryfast/faster/fast/medium/slow/slower/veryslow
+                std::string cmd = "ffmpeg -f yuv4mpegpipe -i - -threads 0 -preset medium -y -pix_fmt yuv420p -colorspace bt709 -color_range tv -crf 10 " + outNames[k];
 
-                if (verbose)
-                    printf("Autoscaling luminance by: %g\n", lumScale);
+                // open pipe to ffmpeg's stdin in binary write mode
+                outs[k] = popen(cmd.c_str(), "w");
+            }
+        #endif
 
-                mi.weight = lumScale;
+            if (!outs[k])
+            {
+                perror(outNames[k].empty() ? "sky.mp4" : outNames[k].c_str());
+                success = false;
             }
+        }
 
-            SkyToHemisphere(sunSky, 256, 256, (uint8_t*) image, 1024, mi);
+        if (success)
+        {
+            SunDirFunc sunDirAt = [&](float time) { return SunDirection(time, timeZone, julianDay, latLong[0], latLong[1]); };
 
-            fwrite(image, sizeof(image), 1, ffmpeg);
+            success = SkyToMovie(pool, sunSky, sunDirAt, numViews, views.data(), mi, movieInfo, outs.data());
         }
 
-        if (pclose(ffmpeg) == 0)
-            printf("wrote sky.mp4\n");
-        else
-            printf("failed to write sky.mp4\n");
+        for (int k = 0; k < numViews; k++)
+        {
+            if (!outs[k])
+                continue;
+
+            bool closed;
+
+        #ifndef _MSC_VER
+            if (!movieFile)
+                closed = pclose(outs[k]) == 0;
+            else
+        #endif
+                closed = fclose(outs[k]) == 0;
+
+            ReportWrite(outNames[k].c_str(), success && closed);
+        }
+
+        return success ? 0 : -1;
     }
-#endif
-    else
-    {
-        uint32_t image   [256][256];
-        Vec3f    imageHDR[256][256];
 
-        SkyToHemisphere(sunSky, 256, 256, (uint8_t*) image, 1024, mi);
+    // Mirroring works across views of the same projection, e.g., the cube faces
+    if (mirror)
+        for (int begin = 0, end; begin < numViews; begin = end)
+        {
+            for (end = begin + 1; end < numViews && views[end].key.projection == views[begin].key.projection; end++)
+                ;
 
-        snprintf(fileName, 32, "sky-hemi.png");
+            Mirror(pool, sunSky, end - begin, &views[begin], verbose);
+        }
 
-        if (stbi_write_png(fileName, 256, 256, 4, image[0], 0) != 0)
-            printf("wrote %s\n", fileName);
-        else
-            printf("failed to write %s\n", fileName);
+    std::vector<std::string> fileNamesPNG(numViews);
+    std::vector<std::string> fileNamesPFM(numViews);
+    std::vector<const char*> namesPNG(numViews);
+    std::vector<const char*> namesPFM(numViews);
 
-        cStats stats;
-        SkyToHemisphere(sunSky, 256, 256, imageHDR[0], mi, verbose ? &stats : nullptr);
+    for (int k = 0; k < numViews; k++)
+    {
+        fileNamesPNG[k] = names[k] + ".png";
+        fileNamesPFM[k] = names[k] + ".pfm";
 
-        snprintf(fileName, 32, "sky-hemi.pfm");
+        namesPNG[k] = fileNamesPNG[k].c_str();
+        namesPFM[k] = fileNamesPFM[k].c_str();
+    }
 
-        if (PFMWrite(fileName, 256, 256, imageHDR[0]))
-            printf("wrote %s\n", fileName);
-        else
-            printf("failed to write %s\n", fileName);
+    cStats stats;
+    SkyToFiles(pool, sunSky, numViews, views.data(), namesPNG.data(), namesPFM.data(), mi, verbose ? &stats : nullptr);
 
-        if (verbose)
-        {
-            printf("avg: %8.2f, %8.2f, %8.2f\n", stats.avg.x, stats.avg.y, stats.avg.z);
-            printf("max: %8.2f, %8.2f, %8.2f\n", stats.max.x, stats.max.y, stats.max.z);
-            printf("dev: %8.2f, %8.2f, %8.2f\n", stats.dev.x, stats.dev.y, stats.dev.z);
-        }
+    if (verbose)
+    {
+        printf("avg: %8.2f, %8.2f, %8.2f\n", stats.avg.x, stats.avg.y, stats.avg.z);
+        printf("max: %8.2f, %8.2f, %8.2f\n", stats.max.x, stats.max.y, stats.max.z);
+        printf("dev: %8.2f, %8.2f, %8.2f\n", stats.dev.x, stats.dev.y, stats.dev.z);
     }
 
     return 0;
@@ -9,6 +9,7 @@
 // - unused functions
 // - doc comments
 // + STB_IMAGE_DECLARATION if you only want the declarations
+// + band-wise png writing (stbi_write_png_begin etc.), for streaming and parallel compression
 //
 // stb_image - v2.19 - public domain image loader - http://nothings.org/stb/stb_image.h
 //                                  no warranty implied; use at your own risk
@@ -108,6 +109,28 @@ STBIDEF int stbi_write_tga(char const *filename, int w, int h, int comp, const v
 
 STBIDEF stbi_uc *stbi_write_png_to_mem(stbi_uc *pixels, int stride_bytes, int x, int y, int n, int *out_len);
 
+// Band-wise png writing. The image is split into bands of rows, each compressed
+// independently by stbi_write_png_compress_band, which is thread-safe, and then
+// written in top-to-bottom order with stbi_write_png_band.
+typedef struct
+{
+   FILE        *f;
+   unsigned int adler;     // of the uncompressed data written so far
+} stbi_png_stream;
+
+typedef struct
+{
+   stbi_uc     *data;      // compressed
+   int          len;
+   unsigned int adler;     // of the uncompressed band
+   int          raw_len;
+} stbi_png_band;
+
+STBIDEF int  stbi_write_png_begin(stbi_png_stream *s, char const *filename, int x, int y, int n);
+STBIDEF int  stbi_write_png_compress_band(stbi_png_band *band, const void *pixels, int stride_bytes, int x, int y, int n, int last);
+STBIDEF int  stbi_write_png_band(stbi_png_stream *s, stbi_png_band *band);    // also frees band->data
+STBIDEF int  stbi_write_png_end(stbi_png_stream *s);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3658,7 +3681,9 @@ static unsigned int stbiw__zhash(unsigned char *data)
 
 #define stbiw__ZHASH   16384
 
-unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+// Appends a fixed huffman deflate block to 'out'. If not last, it's followed by
+// an empty stored block, as for zlib's Z_SYNC_FLUSH, to leave a byte boundary.
+static unsigned char *stbiw__zlib_deflate(unsigned char *out, unsigned char *data, int data_len, int quality, int last)
 {
    static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
    static unsigned char  lengtheb[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
@@ -3666,13 +3691,10 @@ unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_l
    static unsigned char  disteb[]  = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
    unsigned int bitbuf=0;
    int i,j, bitcount=0;
-   unsigned char *out = NULL;
    unsigned char **hash_table[stbiw__ZHASH]; // 64KB on the stack!
    if (quality < 5) quality = 5;
 
-   stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
-   stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
-   stbiw__zlib_add(1,1);  // BFINAL = 1
+   stbiw__zlib_add(last ? 1 : 0,1);  // BFINAL
    stbiw__zlib_add(1,2);  // BTYPE = 1 -- fixed huffman
 
    for (i=0; i < stbiw__ZHASH; ++i)
@@ -3733,38 +3755,74 @@ unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_l
    for (;i < data_len; ++i)
       stbiw__zlib_huffb(data[i]);
    stbiw__zlib_huff(256); // end of block
+   if (!last) {
+      stbiw__zlib_add(0,1);  // BFINAL = 0
+      stbiw__zlib_add(0,2);  // BTYPE = 0 -- stored
+   }
    // pad with 0 bits to byte boundary
    while (bitcount)
       stbiw__zlib_add(0,1);
+   if (!last) {
+      // stored block LEN = 0, NLEN = ~0
+      stbiw__sbpush(out, 0x00);
+      stbiw__sbpush(out, 0x00);
+      stbiw__sbpush(out, 0xff);
+      stbiw__sbpush(out, 0xff);
+   }
 
    for (i=0; i < stbiw__ZHASH; ++i)
       (void) stbiw__sbfree(hash_table[i]);
 
-   {
-      // compute adler32 on input
-      unsigned int i=0, s1=1, s2=0, blocklen = data_len % 5552;
-      int j=0;
-      while (j < data_len) {
-         for (i=0; i < blocklen; ++i) s1 += data[j+i], s2 += s1;
-         s1 %= 65521, s2 %= 65521;
-         j += blocklen;
-         blocklen = 5552;
-      }
-      stbiw__sbpush(out, (unsigned char) (s2 >> 8));
-      stbiw__sbpush(out, (unsigned char) s2);
-      stbiw__sbpush(out, (unsigned char) (s1 >> 8));
-      stbiw__sbpush(out, (unsigned char) s1);
+   return out;
+}
+
+static unsigned int stbiw__adler32(unsigned char *data, int data_len)
+{
+   unsigned int i=0, s1=1, s2=0, blocklen = data_len % 5552;
+   int j=0;
+   while (j < data_len) {
+      for (i=0; i < blocklen; ++i) s1 += data[j+i], s2 += s1;
+      s1 %= 65521, s2 %= 65521;
+      j += blocklen;
+      blocklen = 5552;
    }
+   return (s2 << 16) | s1;
+}
+
+// adler32 of a followed by b, given b's length
+static unsigned int stbiw__adler32_combine(unsigned int adler_a, unsigned int adler_b, int len_b)
+{
+   unsigned int rem = (unsigned int) (len_b % 65521);
+   unsigned int a1 = adler_a & 0xffff, a2 = adler_a >> 16;
+   unsigned int b1 = adler_b & 0xffff, b2 = adler_b >> 16;
+   unsigned int s1 = (a1 + b1 + 65521 - 1) % 65521;
+   unsigned int s2 = (unsigned int) ((a2 + b2 + (unsigned long long) rem * a1 + 65521 - rem) % 65521);
+   return (s2 << 16) | s1;
+}
+
+unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+{
+   unsigned char *out = NULL;
+   unsigned int adler;
+
+   stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
+   stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
+   out = stbiw__zlib_deflate(out, data, data_len, quality, 1);
+
+   adler = stbiw__adler32(data, data_len);
+   stbiw__sbpush(out, (unsigned char) (adler >> 24));
+   stbiw__sbpush(out, (unsigned char) (adler >> 16));
+   stbiw__sbpush(out, (unsigned char) (adler >> 8));
+   stbiw__sbpush(out, (unsigned char) adler);
    *out_len = stbiw__sbn(out);
    // make returned pointer freeable
    STBIW_MEMMOVE(stbiw__sbraw(out), out, *out_len);
    return (unsigned char *) stbiw__sbraw(out);
 }
 
-unsigned int stbiw__crc32(unsigned char *buffer, int len)
+static unsigned int stbiw__crc32_update(unsigned int crc, unsigned char *buffer, int len)
 {
    static unsigned int crc_table[256];
-   unsigned int crc = ~0u;
    int i,j;
    if (crc_table[1] == 0)
       for(i=0; i < 256; i++)
@@ -3772,7 +3830,12 @@ unsigned int stbiw__crc32(unsigned char *buffer, int len)
             crc_table[i] = (crc_table[i] >> 1) ^ (crc_table[i] & 1 ? 0xedb88320 : 0);
    for (i=0; i < len; ++i)
       crc = (crc >> 8) ^ crc_table[buffer[i] ^ (crc & 0xff)];
-   return ~crc;
+   return crc;
+}
+
+unsigned int stbiw__crc32(unsigned char *buffer, int len)
+{
+   return ~stbiw__crc32_update(~0u, buffer, len);
 }
 
 #define stbiw__wpng4(o,a,b,c,d) ((o)[0]=(unsigned char)(a),(o)[1]=(unsigned char)(b),(o)[2]=(unsigned char)(c),(o)[3]=(unsigned char)(d),(o)+=4)
@@ -3793,16 +3856,14 @@ static unsigned char stbiw__paeth(int a, int b, int c)
    return (unsigned char) c;
 }
 
-unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+// Returns the filtered scanlines, each prefixed with its filter type. If
+// 'band' is set, the first row may not be the image's first, so it only uses
+// filters that don't refer to the row above.
+static unsigned char *stbiw__png_filter(unsigned char *pixels, int stride_bytes, int x, int y, int n, int band)
 {
-   int ctype[5] = { -1, 0, 4, 2, 6 };
-   unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
-   unsigned char *out,*o, *filt, *zlib;
+   unsigned char *filt;
    signed char *line_buffer;
-   int i,j,k,p,zlen;
-
-   if (stride_bytes == 0)
-      stride_bytes = x * n;
+   int i,j,k,p;
 
    filt = (unsigned char *) STBIW_MALLOC((x*n+1) * y); if (!filt) return 0;
    line_buffer = (signed char *) STBIW_MALLOC(x * n); if (!line_buffer) { STBIW_FREE(filt); return 0; }
@@ -3810,9 +3871,10 @@ unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, in
       static int mapping[] = { 0,1,2,3,4 };
       static int firstmap[] = { 0,1,0,5,6 };
       int *mymap = j ? mapping : firstmap;
+      int num_filters = (j || !band) ? 5 : 2;
       int best = 0, bestval = 0x7fffffff;
       for (p=0; p < 2; ++p) {
-         for (k= p?best:0; k < 5; ++k) {
+         for (k= p?best:0; k < num_filters; ++k) {
             int type = mymap[k],est=0;
             unsigned char *z = pixels + stride_bytes*j;
             for (i=0; i < n; ++i)
@@ -3847,6 +3909,22 @@ unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, in
       STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
    }
    STBIW_FREE(line_buffer);
+   return filt;
+}
+
+static const int stbiw__png_ctype[5] = { -1, 0, 4, 2, 6 };
+static const unsigned char stbiw__png_sig[8] = { 137,80,78,71,13,10,26,10 };
+
+unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+{
+   unsigned char *out,*o, *filt, *zlib;
+   int zlen;
+
+   if (stride_bytes == 0)
+      stride_bytes = x * n;
+
+   filt = stbiw__png_filter(pixels, stride_bytes, x, y, n, 0);
+   if (!filt) return 0;
    zlib = stbi_zlib_compress(filt, y*( x*n+1), &zlen, 8); // increase 8 to get smaller but use more memory
    STBIW_FREE(filt);
    if (!zlib) return 0;
@@ -3857,13 +3935,13 @@ unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, in
    *out_len = 8 + 12+13 + 12+zlen + 12;
 
    o=out;
-   STBIW_MEMMOVE(o,sig,8); o+= 8;
+   STBIW_MEMMOVE(o,stbiw__png_sig,8); o+= 8;
    stbiw__wp32(o, 13); // header length
    stbiw__wptag(o, "IHDR");
    stbiw__wp32(o, x);
    stbiw__wp32(o, y);
    *o++ = 8;
-   *o++ = (unsigned char) ctype[n];
+   *o++ = (unsigned char) stbiw__png_ctype[n];
    *o++ = 0;
    *o++ = 0;
    *o++ = 0;
@@ -3899,6 +3977,101 @@ int stbi_write_png(char const *filename, int x, int y, int comp, const void *dat
    return 1;
 }
 
+static int stbiw__png_write_chunk(FILE *f, const char *tag, unsigned char *data, int len)
+{
+   unsigned char header[8], crc[4], *o;
+   unsigned int c;
+
+   o = header;
+   stbiw__wp32(o, len);
+   stbiw__wptag(o, tag);
+
+   c = stbiw__crc32_update(~0u, header + 4, 4);
+   c = ~stbiw__crc32_update(c, data, len);
+   o = crc;
+   stbiw__wp32(o, c);
+
+   return fwrite(header, 1, 8, f) == 8
+       && (len == 0 || fwrite(data, 1, len, f) == (size_t) len)
+       && fwrite(crc, 1, 4, f) == 4;
+}
+
+int stbi_write_png_begin(stbi_png_stream *s, char const *filename, int x, int y, int n)
+{
+   unsigned char ihdr[13], zhdr[2] = { 0x78, 0x5e }, *o = ihdr;
+
+   s->adler = 1;
+   s->f = fopen(filename, "wb");
+   if (!s->f) return 0;
+
+   stbiw__wp32(o, x);
+   stbiw__wp32(o, y);
+   *o++ = 8;
+   *o++ = (unsigned char) stbiw__png_ctype[n];
+   *o++ = 0;
+   *o++ = 0;
+   *o++ = 0;
+
+   // the zlib stream continues across IDAT chunks, so its header gets one to itself
+   if (fwrite(stbiw__png_sig, 1, 8, s->f) != 8
+    || !stbiw__png_write_chunk(s->f, "IHDR", ihdr, 13)
+    || !stbiw__png_write_chunk(s->f, "IDAT", zhdr, 2)) {
+      fclose(s->f);
+      s->f = NULL;
+      return 0;
+   }
+   return 1;
+}
+
+int stbi_write_png_compress_band(stbi_png_band *band, const void *pixels, int stride_bytes, int x, int y, int n, int last)
+{
+   unsigned char *filt, *out = NULL;
+
+   if (stride_bytes == 0)
+      stride_bytes = x * n;
+
+   // The band's first row only uses filters without the row above, so bands are independent
+   filt = stbiw__png_filter((unsigned char *) pixels, stride_bytes, x, y, n, 1);
+   if (!filt) return 0;
+
+   band->raw_len = y * (x*n+1);
+   band->adler = stbiw__adler32(filt, band->raw_len);
+
+   out = stbiw__zlib_deflate(out, filt, band->raw_len, 8, last);
+   STBIW_FREE(filt);
+
+   band->len = stbiw__sbn(out);
+   STBIW_MEMMOVE(stbiw__sbraw(out), out, band->len);
+   band->data = (unsigned char *) stbiw__sbraw(out);
+   return 1;
+}
+
+int stbi_write_png_band(stbi_png_stream *s, stbi_png_band *band)
+{
+   int ok = s->f && stbiw__png_write_chunk(s->f, "IDAT", band->data, band->len);
+
+   s->adler = stbiw__adler32_combine(s->adler, band->adler, band->raw_len);
+   STBIW_FREE(band->data);
+   band->data = NULL;
+   return ok;
+}
+
+int stbi_write_png_end(stbi_png_stream *s)
+{
+   unsigned char adler[4], *o = adler;
+   int ok;
+
+   if (!s->f) return 0;
+
+   stbiw__wp32(o, s->adler);
+   ok = stbiw__png_write_chunk(s->f, "IDAT", adler, 4)
+     && stbiw__png_write_chunk(s->f, "IEND", NULL, 0);
+
+   ok = (fclose(s->f) == 0) && ok;
+   s->f = NULL;
+   return ok;
+}
+
 #ifdef STB_UNDEF_CRT_SECURE_NO_WARNINGS
     #undef _CRT_SECURE_NO_WARNINGS
     #undef STB_UNDEF_CRT_SECURE_NO_WARNINGS